@@ -0,0 +1,26 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "common.h"
+
+#define ACPI_MAX_CPUS 16
+
+//what the MADT told us about the interrupt hardware, filled in by acpi_init
+struct madt_info {
+    uint32_t lapic_addr;
+    uint32_t pcat_compat;             //a pair of 8259s is wired up and has to be masked
+    uint32_t cpu_count;
+    uint32_t cpu_apic_id[ACPI_MAX_CPUS];
+    uint32_t ioapic_addr;             //only the ioapic that owns gsi 0 is used
+    uint32_t ioapic_gsi_base;
+    uint32_t isa_gsi[16];             //legacy irq -> gsi, after interrupt source overrides
+    uint16_t isa_flags[16];           //mps inti flags, polarity in bits 0-1, trigger in bits 2-3
+};
+
+extern struct madt_info madt;
+
+//finds the RSDP and walks the RSDT/XSDT for the MADT, returns 0 if there isn't one
+int acpi_init(void);
+void* acpi_find_table(const char sig[4]);
+
+#endif
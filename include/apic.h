@@ -0,0 +1,34 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "common.h"
+
+//vectors owned by the local apic, well above the legacy irqs at 32..47
+#define APIC_TIMER_VECTOR    0xF0
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+//finds the apics through the madt, masks the 8259s and routes the isa irqs through the ioapic.
+//returns 0 (and leaves the pic alone) if there is no madt, ioapic or local apic
+int apic_init(void);
+int apic_active(void);
+void apic_local_init(void);   //per cpu part, apic_init does it for the boot cpu
+uint32_t apic_id(void);
+void apic_eoi(void);
+
+//inter-processor interrupts, icr is the low half of the interrupt command register
+#define ICR_FIXED   (0 << 8)
+#define ICR_INIT    (5 << 8)
+#define ICR_STARTUP (6 << 8)
+#define ICR_ASSERT  (1 << 14)
+#define ICR_SELF    (1 << 18) //destination shorthand, the apic id is ignored
+void apic_send_ipi(uint32_t dest_apic_id, uint32_t icr);
+
+//legacy irq lines (0-15) through the ioapic
+void ioapic_mask(uint8_t irq);
+void ioapic_unmask(uint8_t irq);
+
+//local apic timer as a one-shot deadline on APIC_TIMER_VECTOR, tsc-deadline mode when the cpu has it
+int apic_timer_init(void);
+int apic_timer_arm(uint64_t deadline_ns);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "common.h"
+
+//bump pointer scratch memory. allocation moves a pointer, nothing is freed on its own:
+//take a mark, allocate whatever, release back to the mark and it's all gone at once.
+//chunks come from the page allocator, anything bigger than a chunk gets a chunk of its own
+#define ARENA_CHUNK_PAGES 4
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk* top;   //allocations come from here, older chunks hang off it
+    struct arena_chunk* spare; //one default size chunk kept around so a command doesn't cost a page allocation
+};
+
+typedef struct {
+    struct arena_chunk* chunk;
+    uint32_t used;
+} arena_mark_t;
+
+#define ARENA_INIT { 0, 0 }
+
+//8 byte aligned, 0 only when the page allocator is out
+void* arena_alloc(struct arena* a, uint32_t size);
+char* arena_strdup(struct arena* a, const char* s);
+//makes a bigger copy of the newest allocation, or grows it in place when nothing came after it
+void* arena_grow(struct arena* a, void* p, uint32_t old_size, uint32_t new_size);
+
+arena_mark_t arena_mark(struct arena* a);
+void arena_release(struct arena* a, arena_mark_t m);
+//gives every chunk back, spare included
+void arena_destroy(struct arena* a);
+
+#endif
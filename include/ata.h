@@ -0,0 +1,25 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "common.h"
+
+//the master drive on the primary ide channel (qemu -hda), lba28 so up to 128GB.
+//transfers go through bus-master dma when the pci ide controller has it: the caller
+//blocks until irq14 says the disk is done. without it they fall back to pio
+#define ATA_SECTOR 512
+
+//needs irqs and the timer, call after threads_init. 0 if there is a disk
+int ata_init(void);
+int ata_present(void);
+uint32_t ata_sectors(void);
+
+//count sectors starting at lba, 0 or -1 on a device error or timeout. buffers can be
+//anywhere in memory, it's all identity mapped; an odd address just means pio
+int ata_read(uint32_t lba, uint32_t count, void* buf);
+int ata_write(uint32_t lba, uint32_t count, const void* buf);
+//makes sure what was written is on the platter, not in the drive's cache
+int ata_flush(void);
+
+void ata_print(void);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "common.h"
+
+//monotonic clock, everything is integer math so no x87 work on the hot path
+void hpet_init(void);
+uint64_t hpet_read(void);
+uint64_t clock_ns(void);
+uint64_t clock_us(void);
+uint32_t uptime_seconds(void);
+
+//hpet comparator 0 as a one-shot deadline timer, see timer.c
+int hpet_oneshot_init(void);
+int hpet_arm(uint64_t deadline_ns);
+
+//tsc helpers, tsc_to_ns only works after hpet_init has calibrated the tsc
+uint64_t tsc_to_ns(uint64_t cycles);
+uint32_t tsc_khz(void);
+int clock_uses_tsc(void);
+uint64_t clock_ns_to_tsc(uint64_t deadline_ns);
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
@@ -9,5 +9,32 @@ typedef unsigned char  uint8_t;
 typedef int            int32_t;
 typedef short          int16_t;
 typedef char           int8_t;
+typedef unsigned long long uint64_t;
+typedef long long          int64_t;
+
+//64 bit divided by 32 bit without needing libgcc, the remainder goes in rem if it isn't null
+//(a plain "/" on a uint64_t makes gcc call __udivdi3 which we don't link)
+static inline uint64_t div64_u32(uint64_t n, uint32_t d, uint32_t* rem) {
+    uint32_t hi = (uint32_t)(n >> 32), lo = (uint32_t)n, qhi = 0, r;
+    if (hi >= d) { qhi = hi / d; hi = hi % d; }
+    __asm__ ("divl %4" : "=a"(lo), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+    if (rem) *rem = r;
+    return ((uint64_t)qhi << 32) | lo;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    __asm__ volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+//model specific registers
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
 
 #endif
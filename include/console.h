@@ -0,0 +1,22 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "common.h"
+
+//where console output goes, any mix of these. 0 throws everything away (bench -q uses that)
+#define CONSOLE_VGA    1
+#define CONSOLE_SERIAL 2
+
+extern int console_targets;
+
+void clear_screen(void);
+void putchar(char ch);
+void puts(const char* s);
+void print_uint(uint32_t num);
+//right aligned in width columns, for tables
+void print_padded(uint32_t num, int width);
+void print_uint64(uint64_t num);
+void print_hex(uint32_t num);
+void print_ns_as_us(uint64_t ns);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef FS_H
+#define FS_H
+
+#include "common.h"
+
+//the ram filesystem. file_t objects come from a slab cache and are found by (directory, name)
+//through an open addressing hash index, the table of them grows as files are created. file
+//data lives in the region at FS_START_ADDR, handed out in extents of FS_BLOCK sized blocks.
+//paths are relative to the working directory unless they start with /. with an ata disk
+//the whole thing is loaded from it at boot and written back by fs_sync
+#define MAX_NAME 16    //per path component, longer ones are cut down to fit
+#define FS_PATH_MAX 256
+#define FS_START_ADDR  0x400000 //start of the memory we use for our filesystem
+#define FS_REGION_SIZE 0x400000 //the whole second 4MB, one large page
+#define FS_BLOCK       256
+#define FS_BLOCKS      (FS_REGION_SIZE / FS_BLOCK)
+
+//a run of blocks, in block numbers from the start of the region
+struct extent {
+    uint32_t start;
+    uint32_t count;
+};
+
+//file structure/class, a directory is one too
+typedef struct file {
+    char name[MAX_NAME];
+    uint8_t is_dir;
+    uint32_t size;
+    struct extent* ext;   //kmalloc'd, in file order
+    uint16_t ext_count;
+    uint16_t ext_cap;
+    uint32_t slot;        //place in the file table, fixed for the file's life
+    uint32_t gen;         //never reused, tells a stale handle from the file now in its slot
+    struct file* parent;  //0 only for the root
+    struct file* first_child; //directories, in the order they were added
+    struct file* last_child;
+    struct file* next;    //siblings
+    struct file* prev;
+    uint32_t children;
+    uint32_t disk_start;  //first data sector on disk as of the last sync (or load)
+    uint32_t ino;         //place in the inode table, only meaningful during a sync
+    uint8_t dirty;        //contents changed since then
+    uint16_t pins;        //writers in flight, a removed file is only freed once they're done
+    uint8_t removed;      //rm'd while pinned, the last unpin frees it
+    volatile uint8_t writing; //one writer at a time, the others sleep until it's done
+} file_t;
+
+//what the calls that can fail for more than one reason hand back
+enum {
+    FS_NOT_FOUND = -1,
+    FS_EXISTS    = -2,
+    FS_NOT_EMPTY = -3,
+    FS_BUSY      = -4,
+    FS_NOT_DIR   = -5,
+    FS_BAD_PATH  = -6,
+    FS_NO_DISK   = -7,
+    FS_IO        = -8,
+    FS_NO_SPACE  = -9,
+};
+const char* fs_strerror(int err);
+
+//refers to a file without pinning it: fs_get hands back 0 once that file is gone,
+//even if the slot has been given to a new file since
+typedef struct {
+    uint32_t slot;
+    uint32_t gen;
+} fs_handle_t;
+
+//loads whatever is on the disk (ata_init first), the two default files otherwise
+void fs_init(void);
+//writes changed files and the whole tree to the disk, files written or an FS_ error.
+//what doesn't fit in the disk's inode table stays in ram only and is counted in skipped
+int fs_sync(uint32_t* skipped);
+
+//files and directories / regular files only
+file_t* fs_lookup(const char* path);
+file_t* find_file(const char* path);
+//0 if the path is taken, its directory doesn't exist or there is no memory for it
+file_t* fs_create(const char* path, const uint8_t* data, uint32_t size);
+file_t* fs_mkdir(const char* path);
+//replace the contents / add to the end, -1 (and nothing written) when the region is full
+int fs_write(file_t* f, const uint8_t* data, uint32_t size);
+int fs_append(file_t* f, const uint8_t* data, uint32_t size);
+uint32_t fs_read(const file_t* f, uint32_t offset, void* buf, uint32_t len);
+//the bytes of the i-th extent without copying them, 0 past the last one
+const uint8_t* fs_extent(const file_t* f, uint32_t i, uint32_t* len);
+//the extent list and size copied out under the lock, for readers on other cpus that
+//can't keep the file_t from being freed under them. -1 once the handle is stale
+int fs_snapshot(fs_handle_t h, struct extent* ext, uint32_t max, uint32_t* count, uint32_t* size);
+//where block b of the region is, whoever owns it now
+const uint8_t* fs_block(uint32_t b);
+//directories only once they're empty
+int fs_remove(const char* path);
+//to can be a new path or a directory to move into
+int fs_rename(const char* from, const char* to);
+
+int fs_chdir(const char* path);
+const char* fs_getcwd(void);
+file_t* fs_cwd(void);
+
+fs_handle_t fs_handle(const file_t* f);
+file_t* fs_get(fs_handle_t h);
+
+//every live file and directory but the root in table order, start with *pos = 0 and call until it returns 0
+uint32_t fs_count(void);
+file_t* fs_next(uint32_t* pos);
+
+void fs_print(void);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+#include "common.h"
+
+/* regs struct layout must match the push order in isr.S */
+struct regs {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags, useresp, ss;
+};
+
+//legacy irq n arrives on vector IRQ_BASE + n
+#define IRQ_BASE 32
+
+typedef void (*irq_fn)(struct regs* r, void* ctx);
+
+void idt_install(void);
+void idt_reload(void);
+void isrs_install(void);
+//not a handler, the double fault task starts here (see smp.c) and never returns
+void double_fault_task(void);
+void irq_install(void);
+void irq_unmask(uint8_t irq);
+void irq_mask(uint8_t irq);
+void init_pit(uint32_t frequency);
+
+//handlers run with interrupts off and the eoi already sent
+int irq_register(uint8_t irq, irq_fn fn, void* ctx);
+void irq_unregister(uint8_t irq);
+int interrupt_register(uint8_t vector, irq_fn fn, void* ctx);
+void interrupt_unregister(uint8_t vector);
+
+//irqstat numbers
+void interrupt_record_latency(uint8_t vector, uint64_t late_ns);
+void interrupt_reset_stats(void);
+void interrupt_print_stats(void);
+
+//turns interrupts off and hands back the old flags so nested callers restore correctly
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) __asm__ volatile ("sti" : : : "memory");
+}
+
+#endif
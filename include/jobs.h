@@ -0,0 +1,25 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "common.h"
+
+//work stealing: every cpu has its own deque of runnable jobs, it pushes and pops
+//at the bottom and idle cpus steal from the top of somebody else's
+#define JOB_WAKE_VECTOR 0xF1 //ipi that gets an idle cpu out of hlt to go stealing
+
+//a spawned job, the caller owns the memory and must keep it alive until join() returns
+struct job {
+    void (*fn)(void* arg);   //runs on whichever cpu gets to it first, with interrupts on
+    void* arg;
+    volatile uint32_t done;
+};
+
+void jobs_init(void);
+void spawn(struct job* j, void (*fn)(void*), void* arg);
+//waits for the job, running other jobs (ours or stolen) in the meantime
+void join(struct job* j);
+
+//what the aps run once they are up, never returns
+void jobs_worker_loop(void);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include "common.h"
+
+#define KEY_UP     0xE048
+#define KEY_DOWN   0xE050
+#define KEY_LEFT   0xE04B
+#define KEY_RIGHT  0xE04D
+
+void keyboard_init(void);
+
+//blocks (with hlt) until a key arrives
+int getkey(void);
+
+//returns -1 straight away if nothing has been typed
+int getkey_nowait(void);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include "common.h"
+
+//kernel symbol table, generated from the linked kernel by tools/gensyms.sh
+struct ksym {
+    uint32_t addr;
+    const char* name;
+};
+
+extern const struct ksym ksyms[];
+extern const uint32_t ksym_count;
+
+//index of the function containing addr, -1 if it isn't in kernel text
+int ksym_lookup(uint32_t addr);
+
+#endif
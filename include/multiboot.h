@@ -0,0 +1,35 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "common.h"
+
+//multiboot 1, what grub hands kernel_main in ebx (eax holds MULTIBOOT_MAGIC)
+#define MULTIBOOT_MAGIC 0x2BADB002
+
+#define MB_INFO_MEM  (1 << 0) //mem_lower/mem_upper are valid
+#define MB_INFO_MMAP (1 << 6) //mmap_addr/mmap_length are valid
+
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower;   //kb below 1MB
+    uint32_t mem_upper;   //kb above 1MB, up to the first hole
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed));
+
+//size doesn't count itself, the next entry is at (entry + size + 4)
+struct multiboot_mmap_entry {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed));
+
+#define MB_MMAP_AVAILABLE 1
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "common.h"
+
+//one address space, identity mapped. the first 4MB goes through a page table so single
+//pages can differ (the null page, vga, guard pages), everything above it is 4MB pse pages:
+//write back up to the top of ram, uncached above (that's where the apic, ioapic and hpet live)
+#define PDE_PRESENT 0x001
+#define PDE_WRITE   0x002
+#define PDE_PWT     0x008
+#define PDE_PCD     0x010
+#define PDE_PS      0x080 //4MB page instead of a pointer to a page table
+
+#define PAGE_LARGE  0x400000
+
+//needs pmm_init for the top of ram and isrs_install for the page fault handler
+void paging_init(void);
+//every other cpu points at the same page directory and pat layout
+void paging_ap_init(void);
+int paging_enabled(void);
+//what goes in cr3, the double fault task needs it before paging is even on
+uint32_t paging_directory(void);
+
+//unmaps one 4k page (inside the first 4MB) so running into it faults instead of corrupting
+//whatever is below a stack. what shows up in the fault message. other cpus only find out
+//when the page drops out of their tlb, so set guards up before anything there touches them
+int paging_guard(uint32_t addr, const char* what);
+const char* paging_guard_name(uint32_t addr);
+
+void paging_print(void);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "common.h"
+#include "multiboot.h"
+
+#define PAGE_SIZE  4096
+#define PAGE_SHIFT 12
+
+//physical page frames, one bit each over the first 4GB. everything starts out used,
+//the usable parts of grub's memory map are freed, then the kernel and low memory are taken back
+void pmm_init(uint32_t magic, struct multiboot_info* mbi);
+void pmm_reserve(uint32_t addr, uint32_t len);
+
+//physical (and, while memory is identity mapped, virtual) address of a free page, 0 if there is none
+uint32_t pmm_alloc(void);
+void pmm_free(uint32_t addr);
+//count physically contiguous pages, for anything bigger than a page that can't be split up
+uint32_t pmm_alloc_run(uint32_t count);
+void pmm_free_run(uint32_t addr, uint32_t count);
+
+uint32_t pmm_total_pages(void);
+uint32_t pmm_free_pages(void);
+//one past the highest usable frame, everything below it is ram (or a small hole in it)
+uint32_t pmm_top_frame(void);
+void pmm_print(void);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "common.h"
+
+struct regs;
+
+//sampling profiler, the timer irq hands it the interrupted register frame
+extern volatile int profile_enabled;
+
+void profile_sample(struct regs* r);
+void profile_start(int callgraph);
+void profile_stop(void);
+void profile_reset(void);
+void profile_report(int top);
+void profile_dump_folded(void);
+
+#endif
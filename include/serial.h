@@ -0,0 +1,17 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "common.h"
+
+//COM1, for getting data out of the kernel to the host (qemu -serial stdio / file).
+//output is buffered and sent from the THRE interrupt once serial_enable_irq has run
+void serial_init(void);
+void serial_enable_irq(void);
+struct regs;
+void serial_irq(struct regs* r, void* ctx);
+void serial_flush(void);
+void serial_putc(char c);
+void serial_write(const char* s);
+void serial_write_uint(uint32_t num);
+
+#endif
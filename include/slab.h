@@ -0,0 +1,51 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "common.h"
+#include "spinlock.h"
+
+//object caches on top of the page allocator. every slab is one page: a small header
+//then as many objects as fit, free ones chained through a pointer inside them. alloc
+//and free are O(1), pop or push on the slab's freelist
+#define SLAB_HWCACHE_ALIGN 1   //start every object on its own cache line
+#define CACHE_LINE         64
+
+struct slab;
+
+struct kmem_cache {
+    const char* name;
+    uint32_t size;          //object size as asked for
+    uint32_t stride;        //distance between objects, size (and link) rounded up to the alignment
+    uint32_t link;          //where in a free object the freelist pointer lives
+    uint32_t first;         //offset of the first object in the page
+    uint32_t per_slab;
+    void (*ctor)(void* obj);
+    struct slab* partial;   //some free objects, allocation comes from here first
+    struct slab* full;
+    struct slab* empty;     //at most one kept around, the rest go back to the page allocator
+    uint32_t slabs;
+    uint32_t in_use;
+    uint32_t allocs;
+    spinlock_t lock;
+    struct kmem_cache* next; //every cache, for slabinfo
+};
+
+//sets up the cache of caches and the kmalloc size classes, needs pmm_init first
+void slab_init(void);
+
+//ctor runs once per object when its slab is carved up (not on every alloc), so objects
+//have to go back to kmem_cache_free in their constructed state
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size, uint32_t flags, void (*ctor)(void*));
+void* kmem_cache_alloc(struct kmem_cache* c);
+void kmem_cache_free(struct kmem_cache* c, void* obj);
+
+//general purpose, power of two size classes from 16 to 1024 bytes, and a top one as big
+//as still fits twice in a page next to the slab header
+#define KMALLOC_MAX 2032
+void* kmalloc(uint32_t size);
+void kfree(void* p);
+char* kstrdup(const char* s);
+
+void slab_print_stats(void);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "common.h"
+#include "acpi.h"
+
+#define MAX_CPUS ACPI_MAX_CPUS
+
+struct work;
+
+//everything that belongs to one cpu. each cpu's %gs points at its own entry,
+//so this_cpu() is a single load and never has to ask the apic who we are
+struct cpu {
+    struct cpu* self;          //must stay first, this_cpu() reads it at %gs:0
+    uint32_t index;
+    uint32_t apic_id;
+    volatile uint32_t online;
+    void* current;             //running thread, 0 until there are threads
+    volatile uint32_t need_resched; //thread.c, switch threads on the way out of the current irq
+    struct work* work_head;    //workq.c, deferred irq work waiting to run on this cpu
+    struct work* work_tail;
+    uint32_t in_drain;
+    uint32_t stack_top;
+    uint64_t online_tsc;       //rdtsc() when it came up
+    uint64_t idle_cycles;      //time spent halted in cpu_idle()
+    uint32_t irqs;             //interrupts taken on this cpu
+    uint32_t jobs_run;         //jobs.c, spawned jobs this cpu ran
+    uint32_t steals;           //how many of those it took off another cpu's deque
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern uint32_t cpu_count;             //cpus we tried to start, including the boot cpu
+extern volatile uint32_t cpus_online;
+
+static inline struct cpu* this_cpu(void) {
+    struct cpu* c;
+    __asm__ volatile ("movl %%gs:0, %0" : "=r"(c));
+    return c;
+}
+
+//gdt with a segment per cpu, has to run before anything calls this_cpu()
+void smp_early_init(void);
+//selector for the idt's task gate on vector 8
+uint16_t smp_double_fault_tss(void);
+//starts the other cpus with INIT-SIPI-SIPI, needs the apic and a running timer
+void smp_init(void);
+
+//call with interrupts off once there is nothing to do, returns after the next interrupt with them on
+void cpu_idle(void);
+
+void smp_print_summary(void);
+void smp_print_cpus(void);
+
+#endif
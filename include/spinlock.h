@@ -0,0 +1,27 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "common.h"
+#include "interrupts.h"
+
+//test and test-and-set, for data more than one cpu touches. always taken with
+//interrupts off so an irq on the same cpu can't spin on a lock its own cpu holds
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline uint32_t spin_lock_irqsave(spinlock_t* l) {
+    uint32_t flags = irq_save();
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE))
+        while (l->locked) __asm__ volatile ("pause");
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* l, uint32_t flags) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+#endif
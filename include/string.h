@@ -9,5 +9,7 @@ const char* cmd_args(const char* input, const char* command);
 int strlen(const char* s);
 void strcpy(char* dest, const char* src);
 void strcat(char* dest, const char* src);
+void* memcpy(void* dest, const void* src, uint32_t n);
+void* memset(void* dest, int c, uint32_t n);
 
 #endif
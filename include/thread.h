@@ -0,0 +1,56 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "common.h"
+#include "arena.h"
+
+//kernel threads on the boot cpu, round robin with a time slice. the other cpus
+//stay on jobs.c, a thread that wants to go wide can still spawn() jobs from here
+#define MAX_THREADS        16
+#define THREAD_STACK_SIZE  0x4000
+#define THREAD_NAME_LEN    64
+#define THREAD_SLICE_US    10000 //10ms, only armed while something else is waiting to run
+
+enum thread_state {
+    THREAD_UNUSED,
+    THREAD_RUNNABLE,   //on the run queue
+    THREAD_RUNNING,
+    THREAD_BLOCKED,    //waiting for thread_wake
+    THREAD_DEAD,       //returned, its slot gets reused once we're off its stack
+};
+
+struct thread {
+    uint32_t esp;              //saved by switch_to, must stay first
+    uint32_t id;
+    enum thread_state state;
+    char name[THREAD_NAME_LEN];
+    void (*fn)(void* arg);
+    void* arg;
+    uint64_t cycles;           //tsc cycles spent running
+    uint64_t last_in;          //rdtsc() when it was last switched in
+    struct thread* next;       //run queue link
+    struct arena scratch;      //command handlers' temporaries, see run_command()
+    uint32_t cmd_depth;        //how deep run_command is nested on this thread, for the trace
+    uint8_t quiet;             //everything this thread prints is dropped (bench -q)
+};
+
+//turns the boot context into the "shell" thread and starts the idle thread
+void threads_init(void);
+int threads_running(void);
+
+struct thread* thread_create(const char* name, void (*fn)(void*), void* arg);
+struct thread* thread_current(void);
+void thread_exit(void);
+
+//block needs interrupts off, it switches away until somebody wakes us and the caller
+//rechecks whatever it was waiting for afterwards (and turns interrupts back on)
+void thread_block(void);
+void thread_wake(struct thread* t);
+
+//picks the next thread, interrupts must be off. interrupt_dispatch calls it on the way out
+//of an irq when the slice ran out or a wakeup wants the cpu
+void schedule(void);
+
+void threads_print(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "common.h"
+
+//one wheel tick (100us), timers fire on tick boundaries
+#define TIMER_TICK_NS 100000
+//pit rate when there is no hpet comparator to run tickless with
+#define TIMER_HZ      1000
+
+//a pending timer, the caller owns the memory (usually on the stack or inside another struct)
+struct timer {
+    struct timer* next;
+    struct timer** pprev;
+    uint64_t expires;           //absolute tick
+    void (*fn)(void* arg);      //runs in the timer bottom half, interrupts on but it must not sleep
+    void* arg;
+};
+
+extern volatile uint32_t timer_ticks; //timer interrupts taken
+
+void timer_subsystem_init(void);
+void timer_setup(struct timer* t, void (*fn)(void*), void* arg);
+void timer_add(struct timer* t, uint64_t expires);
+void timer_add_us(struct timer* t, uint64_t us);
+void timer_del(struct timer* t);
+int timer_pending(struct timer* t);
+uint64_t timer_now(void);
+void timer_tick(void);
+int timer_tickless(void);
+
+//blocks the calling thread until the time has passed (before there are threads it just hlts)
+void sleep_us(uint64_t us);
+
+#endif
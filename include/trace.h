@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+
+//tracepoints, see trace.c. new events go at the end of the enum and in trace_events[]
+enum {
+    TRACE_IRQ,          //a0 = vector, a1 = interrupted eip
+    TRACE_CMD_ENTER,    //a0 = first 4 chars of the command, a1 = nesting depth
+    TRACE_CMD_EXIT,     //a0 = first 4 chars of the command, a1 = nesting depth
+    TRACE_FS_CREATE,    //a0 = first 4 chars of the name, a1 = size
+    TRACE_FIND_FILE,    //a0 = first 4 chars of the name, a1 = 1 if found
+    TRACE_GETKEY,       //a0 = key code
+    TRACE_EVENT_COUNT
+};
+
+extern volatile int trace_enabled;
+
+void trace_emit(uint32_t id, uint32_t a0, uint32_t a1);
+void trace_start(void);
+void trace_stop(void);
+void trace_clear(void);
+void trace_dump(void);
+uint32_t trace_tag(const char* s);
+
+//costs one predicted-not-taken branch when tracing is off
+#define TRACE(id, a0, a1) do { \
+    if (__builtin_expect(trace_enabled, 0)) trace_emit((id), (uint32_t)(a0), (uint32_t)(a1)); \
+} while (0)
+
+#endif
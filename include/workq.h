@@ -0,0 +1,33 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include "common.h"
+
+//deferred irq work (bottom halves). a hard irq handler does the bare minimum (read the
+//device, ack it) and queues a work item. the queue is drained with interrupts back on,
+//on the way out of the irq or from the idle loop, so one slow handler doesn't hold up
+//every other device
+#define DEFER_VECTOR      0xF2  //self ipi to come back for whatever a drain left over
+#define WORK_BUDGET_ITEMS 32    //items per drain
+#define WORK_BUDGET_US    500   //and time per drain, whichever runs out first
+
+//the owner keeps the memory, a queued item must stay alive until it has run
+struct work {
+    struct work* next;
+    void (*fn)(void* arg);  //runs with interrupts on, never alongside another work item on this cpu. must not sleep
+    void* arg;
+    volatile uint32_t pending;
+};
+
+void workq_init(void);
+void work_setup(struct work* w, void (*fn)(void*), void* arg);
+//queues on this cpu, queuing something that is already pending does nothing so a
+//burst of irqs collapses into one run
+void work_queue(struct work* w);
+//runs queued work up to the budget. call with interrupts off, returns with them off
+void work_drain(void);
+int work_pending(void);
+
+void workq_print_stats(void);
+
+#endif
@@ -0,0 +1,177 @@
+#include "../include/common.h"
+#include "../include/acpi.h"
+
+//just enough acpi to find the apics. everything sits below 4GB and memory is
+//identity mapped, so table addresses are used as pointers directly
+
+struct rsdp {
+    char     sig[8];      //"RSD PTR "
+    uint8_t  checksum;
+    char     oem[6];
+    uint8_t  revision;    //0 = acpi 1.0, 2+ has the xsdt fields
+    uint32_t rsdt;
+    uint32_t length;
+    uint64_t xsdt;
+    uint8_t  ext_checksum;
+    uint8_t  reserved[3];
+} __attribute__((packed));
+
+struct sdt_header {
+    char     sig[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem[6];
+    char     oem_table[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct madt_header {
+    struct sdt_header h;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed));
+
+#define MADT_PCAT_COMPAT 1
+
+//madt entry types
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_ISO            2
+#define MADT_LAPIC_OVERRIDE 5
+#define MADT_X2APIC         9
+
+#define MADT_CPU_ENABLED    1
+#define MADT_CPU_ONLINE_CAP 2 //can be brought up later even if not enabled now
+
+struct madt_info madt;
+
+static struct sdt_header* root;
+static int root_is_xsdt = 0;
+
+static uint8_t checksum(const void* p, uint32_t len) {
+    const uint8_t* b = p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) sum += b[i];
+    return sum;
+}
+
+static int sig_eq(const char* a, const char* b, int n) {
+    for (int i = 0; i < n; i++) if (a[i] != b[i]) return 0;
+    return 1;
+}
+
+//the rsdp is 16 byte aligned, in the first 1k of the ebda or in the bios rom area
+static struct rsdp* rsdp_scan(uint32_t start, uint32_t len) {
+    for (uint32_t a = start; a < start + len; a += 16) {
+        struct rsdp* r = (struct rsdp*)a;
+        if (sig_eq(r->sig, "RSD PTR ", 8) && checksum(r, 20) == 0) return r;
+    }
+    return 0;
+}
+
+static struct rsdp* rsdp_find(void) {
+    volatile uint16_t* bda_ebda = (volatile uint16_t*)0x40E; //segment of the ebda, in the bios data area
+    __asm__ ("" : "+r"(bda_ebda)); //gcc assumes nothing lives in the first page and warns otherwise
+    uint32_t ebda = (uint32_t)*bda_ebda << 4;
+    struct rsdp* r = 0;
+    if (ebda >= 0x80000 && ebda < 0xA0000) r = rsdp_scan(ebda, 1024);
+    if (!r) r = rsdp_scan(0xE0000, 0x20000);
+    return r;
+}
+
+void* acpi_find_table(const char sig[4]) {
+    if (!root) return 0;
+    uint32_t entry_size = root_is_xsdt ? 8 : 4;
+    uint32_t n = (root->length - sizeof(struct sdt_header)) / entry_size;
+    uint8_t* entries = (uint8_t*)(root + 1);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t addr;
+        if (root_is_xsdt) {
+            uint64_t a64 = *(uint64_t*)(entries + i * 8);
+            if (a64 >> 32) continue; //can't reach it without paging games
+            addr = (uint32_t)a64;
+        } else {
+            addr = *(uint32_t*)(entries + i * 4);
+        }
+        struct sdt_header* h = (struct sdt_header*)addr;
+        if (sig_eq(h->sig, sig, 4) && checksum(h, h->length) == 0) return h;
+    }
+    return 0;
+}
+
+static void madt_parse(struct madt_header* m) {
+    madt.lapic_addr = m->lapic_addr;
+    madt.pcat_compat = m->flags & MADT_PCAT_COMPAT;
+
+    //isa irqs are identity mapped onto gsis unless an override says otherwise
+    for (int i = 0; i < 16; i++) {
+        madt.isa_gsi[i] = i;
+        madt.isa_flags[i] = 0;
+    }
+
+    uint8_t* p = (uint8_t*)(m + 1);
+    uint8_t* end = (uint8_t*)m + m->h.length;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        switch (p[0]) {
+        case MADT_LAPIC: {
+            uint32_t flags = *(uint32_t*)(p + 4);
+            if ((flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAP)) && madt.cpu_count < ACPI_MAX_CPUS)
+                madt.cpu_apic_id[madt.cpu_count++] = p[3];
+            break;
+        }
+        case MADT_X2APIC: {
+            uint32_t id = *(uint32_t*)(p + 4);
+            uint32_t flags = *(uint32_t*)(p + 8);
+            if ((flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAP)) && madt.cpu_count < ACPI_MAX_CPUS)
+                madt.cpu_apic_id[madt.cpu_count++] = id;
+            break;
+        }
+        case MADT_IOAPIC: {
+            uint32_t addr = *(uint32_t*)(p + 4);
+            uint32_t gsi_base = *(uint32_t*)(p + 8);
+            if (!madt.ioapic_addr || gsi_base < madt.ioapic_gsi_base) {
+                madt.ioapic_addr = addr;
+                madt.ioapic_gsi_base = gsi_base;
+            }
+            break;
+        }
+        case MADT_ISO: {
+            uint8_t bus = p[2], source = p[3];
+            if (bus == 0 && source < 16) {
+                madt.isa_gsi[source] = *(uint32_t*)(p + 4);
+                madt.isa_flags[source] = *(uint16_t*)(p + 8);
+            }
+            break;
+        }
+        case MADT_LAPIC_OVERRIDE: {
+            uint64_t addr = *(uint64_t*)(p + 4);
+            if (!(addr >> 32)) madt.lapic_addr = (uint32_t)addr;
+            break;
+        }
+        }
+        p += p[1];
+    }
+}
+
+int acpi_init(void) {
+    struct rsdp* r = rsdp_find();
+    if (!r) return 0;
+
+    if (r->revision >= 2 && r->xsdt && !(r->xsdt >> 32) && checksum(r, r->length) == 0) {
+        root = (struct sdt_header*)(uint32_t)r->xsdt;
+        root_is_xsdt = 1;
+    } else {
+        root = (struct sdt_header*)r->rsdt;
+        root_is_xsdt = 0;
+    }
+    if (checksum(root, root->length) != 0) { root = 0; return 0; }
+
+    struct madt_header* m = acpi_find_table("APIC");
+    if (!m) return 0;
+    madt_parse(m);
+    return madt.lapic_addr != 0;
+}
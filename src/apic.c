@@ -0,0 +1,233 @@
+#include "../include/common.h"
+#include "../include/apic.h"
+#include "../include/acpi.h"
+#include "../include/clock.h"
+#include "../include/interrupts.h"
+
+//local apic + ioapic. once these are up the 8259s are masked for good: irqs come
+//in through the ioapic, eoi is a single store (or msr write on x2apic) instead of
+//one or two outb's, and every cpu gets its own timer
+#define IA32_APIC_BASE      0x1B
+#define APIC_BASE_X2APIC    (1 << 10)
+#define APIC_BASE_ENABLE    (1 << 11)
+#define IA32_TSC_DEADLINE   0x6E0
+
+#define CPUID1_EDX_APIC         (1 << 9)
+#define CPUID1_ECX_X2APIC       (1 << 21)
+#define CPUID1_ECX_TSC_DEADLINE (1 << 24)
+
+//local apic register offsets, in x2apic mode register off is msr 0x800 + off/16
+#define LAPIC_ID         0x020
+#define LAPIC_TPR        0x080
+#define LAPIC_EOI        0x0B0
+#define LAPIC_SVR        0x0F0
+#define LAPIC_ESR        0x280
+#define LAPIC_ICR_LOW    0x300
+#define LAPIC_ICR_HIGH   0x310 //destination, x2apic has the whole icr in one msr instead
+#define LAPIC_LVT_TIMER  0x320
+#define LAPIC_LVT_LINT0  0x350
+#define LAPIC_LVT_LINT1  0x360
+#define LAPIC_LVT_ERROR  0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR  0x390
+#define LAPIC_TIMER_DIV  0x3E0
+
+#define ICR_PENDING       (1 << 12)
+#define X2APIC_ICR        0x830
+
+#define SVR_ENABLE        (1 << 8)
+#define LVT_MASKED        (1 << 16)
+#define LVT_NMI           (4 << 8)
+#define LVT_TSC_DEADLINE  (2 << 17)
+#define TIMER_DIV_16      0x3
+
+//ioapic, an index register and a data window
+#define IOAPIC_VER        0x01
+#define IOAPIC_REDTBL(n)  (0x10 + 2 * (n))
+#define REDTBL_ACTIVE_LOW (1 << 13)
+#define REDTBL_LEVEL      (1 << 15)
+#define REDTBL_MASKED     (1 << 16)
+
+#define PIC1_DATA 0x21
+#define PIC2_DATA 0xA1
+
+#define APIC_CALIBRATE_NS 10000000 //10ms
+#define APIC_MIN_DELTA_NS 2000     //same idea as the hpet, closer than this is already due
+#define APIC_MAX_DELTA_NS 1000000000ULL //keeps count * mult inside 64 bits, a capped arm just fires early
+
+static volatile uint8_t* lapic;  //mmio base, unused in x2apic mode
+static volatile uint32_t* ioapic;
+static uint32_t ioapic_pins = 0;
+static int apic_on = 0;
+static int x2apic = 0;
+static uint32_t bsp_id = 0;
+
+static int tsc_deadline = 0;
+static uint32_t lapic_inv_mult = 0; //ns -> timer counts, << 24
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    if (x2apic) return (uint32_t)rdmsr(0x800 + (reg >> 4));
+    return *(volatile uint32_t*)(lapic + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    if (x2apic) wrmsr(0x800 + (reg >> 4), val);
+    else *(volatile uint32_t*)(lapic + reg) = val;
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[0] = reg;
+    return ioapic[4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t val) {
+    ioapic[0] = reg;
+    ioapic[4] = val;
+}
+
+int apic_active(void) {
+    return apic_on;
+}
+
+uint32_t apic_id(void) {
+    if (x2apic) return lapic_read(LAPIC_ID);
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void apic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void apic_send_ipi(uint32_t dest_apic_id, uint32_t icr) {
+    if (x2apic) {
+        wrmsr(X2APIC_ICR, ((uint64_t)dest_apic_id << 32) | icr);
+        return;
+    }
+    uint32_t flags = irq_save();
+    lapic_write(LAPIC_ICR_HIGH, dest_apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) __asm__ volatile ("pause");
+    irq_restore(flags);
+}
+
+//works out the ioapic pin for an isa irq and (re)writes its redirection entry
+static void ioapic_route(uint8_t irq, int masked) {
+    uint32_t pin = madt.isa_gsi[irq] - madt.ioapic_gsi_base;
+    if (pin >= ioapic_pins) return;
+
+    //isa defaults are edge triggered active high, overrides can say otherwise (the sci usually does)
+    uint16_t flags = madt.isa_flags[irq];
+    uint32_t lo = IRQ_BASE + irq;
+    if ((flags & 3) == 3) lo |= REDTBL_ACTIVE_LOW;
+    if (((flags >> 2) & 3) == 3) lo |= REDTBL_LEVEL;
+    if (masked) lo |= REDTBL_MASKED;
+
+    uint32_t flags_irq = irq_save();
+    ioapic_write(IOAPIC_REDTBL(pin) + 1, bsp_id << 24);
+    ioapic_write(IOAPIC_REDTBL(pin), lo);
+    irq_restore(flags_irq);
+}
+
+void ioapic_mask(uint8_t irq) {
+    if (irq < 16) ioapic_route(irq, 1);
+}
+
+void ioapic_unmask(uint8_t irq) {
+    if (irq < 16) ioapic_route(irq, 0);
+}
+
+static void apic_spurious(struct regs* r, void* ctx) {
+    (void)r; (void)ctx;
+}
+
+//turns this cpu's local apic on, every cpu runs this for itself
+void apic_local_init(void) {
+    uint64_t base = rdmsr(IA32_APIC_BASE) | APIC_BASE_ENABLE;
+    wrmsr(IA32_APIC_BASE, base);
+    if (x2apic) wrmsr(IA32_APIC_BASE, base | APIC_BASE_X2APIC); //has to go xapic -> x2apic, not straight there
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT0, LVT_MASKED); //the 8259 virtual wire, not used any more
+    lapic_write(LAPIC_LVT_LINT1, LVT_NMI);
+    lapic_write(LAPIC_LVT_ERROR, LVT_MASKED);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_EOI, 0); //in case anything was left in service
+}
+
+int apic_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID1_EDX_APIC)) return 0;
+    if (!acpi_init() || !madt.ioapic_addr) return 0;
+
+    x2apic = (c & CPUID1_ECX_X2APIC) != 0;
+    lapic = (volatile uint8_t*)madt.lapic_addr;
+    ioapic = (volatile uint32_t*)madt.ioapic_addr;
+    ioapic_pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+
+    //the pics stay remapped to 32..47 so anything they still raise lands on a harmless vector
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+
+    apic_local_init();
+    bsp_id = apic_id();
+    for (uint32_t pin = 0; pin < ioapic_pins; pin++)
+        ioapic_write(IOAPIC_REDTBL(pin), REDTBL_MASKED);
+
+    interrupt_register(APIC_SPURIOUS_VECTOR, apic_spurious, 0);
+    apic_on = 1;
+    return 1;
+}
+
+//tsc-deadline mode needs no calibration, it just compares against the tsc. otherwise the
+//timer counts down from the bus clock, which we measure against clock_ns() once
+int apic_timer_init(void) {
+    if (!apic_on) return 0;
+
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if ((c & CPUID1_ECX_TSC_DEADLINE) && clock_uses_tsc()) {
+        tsc_deadline = 1;
+        lapic_write(LAPIC_LVT_TIMER, LVT_TSC_DEADLINE | APIC_TIMER_VECTOR);
+        return 1;
+    }
+
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | APIC_TIMER_VECTOR);
+    uint64_t start = clock_ns();
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    uint64_t now;
+    do { now = clock_ns(); } while (now - start < APIC_CALIBRATE_NS);
+    uint32_t counts = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    if (counts < 100) return 0; //way too slow (or not counting at all), stay on the hpet/pit
+
+    lapic_inv_mult = (uint32_t)div64_u32((uint64_t)counts << 24, (uint32_t)(now - start), 0);
+    lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR); //one-shot
+    return 1;
+}
+
+//same contract as hpet_arm: -1 means the deadline has already passed and no interrupt is coming
+int apic_timer_arm(uint64_t deadline_ns) {
+    uint64_t now = clock_ns();
+    if ((int64_t)(deadline_ns - now) < APIC_MIN_DELTA_NS) return -1;
+
+    if (tsc_deadline) {
+        wrmsr(IA32_TSC_DEADLINE, clock_ns_to_tsc(deadline_ns));
+        return 0;
+    }
+
+    uint64_t delta = deadline_ns - now;
+    if (delta > APIC_MAX_DELTA_NS) delta = APIC_MAX_DELTA_NS;
+    uint64_t count = (delta * lapic_inv_mult) >> 24;
+    if (count == 0) count = 1;
+    if (count > 0xFFFFFFFF) count = 0xFFFFFFFF;
+    lapic_write(LAPIC_TIMER_INIT, (uint32_t)count);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "../include/common.h"
+#include "../include/arena.h"
+#include "../include/pmm.h"
+#include "../include/string.h"
+
+struct arena_chunk {
+    struct arena_chunk* prev;
+    uint32_t pages;
+    uint32_t size;  //usable bytes after the header
+    uint32_t used;
+};
+
+#define ALIGN8(n) (((n) + 7) & ~7u)
+#define CHUNK_DATA(c) ((uint8_t*)(c) + ALIGN8(sizeof(struct arena_chunk)))
+
+static struct arena_chunk* chunk_new(struct arena* a, uint32_t size) {
+    uint32_t header = ALIGN8(sizeof(struct arena_chunk));
+    uint32_t pages = (header + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages < ARENA_CHUNK_PAGES) pages = ARENA_CHUNK_PAGES;
+
+    struct arena_chunk* c;
+    if (pages == ARENA_CHUNK_PAGES && a->spare) {
+        c = a->spare;
+        a->spare = 0;
+    } else {
+        c = (struct arena_chunk*)pmm_alloc_run(pages);
+        if (!c) return 0;
+        c->pages = pages;
+        c->size = pages * PAGE_SIZE - header;
+    }
+    c->used = 0;
+    c->prev = a->top;
+    a->top = c;
+    return c;
+}
+
+static void chunk_drop(struct arena* a, struct arena_chunk* c) {
+    if (c->pages == ARENA_CHUNK_PAGES && !a->spare) a->spare = c;
+    else pmm_free_run((uint32_t)c, c->pages);
+}
+
+void* arena_alloc(struct arena* a, uint32_t size) {
+    size = ALIGN8(size);
+    struct arena_chunk* c = a->top;
+    if (!c || c->size - c->used < size) {
+        c = chunk_new(a, size);
+        if (!c) return 0;
+    }
+    void* p = CHUNK_DATA(c) + c->used;
+    c->used += size;
+    return p;
+}
+
+char* arena_strdup(struct arena* a, const char* s) {
+    uint32_t n = strlen(s) + 1;
+    char* p = arena_alloc(a, n);
+    if (p) memcpy(p, s, n);
+    return p;
+}
+
+void* arena_grow(struct arena* a, void* p, uint32_t old_size, uint32_t new_size) {
+    struct arena_chunk* c = a->top;
+    uint32_t old = ALIGN8(old_size), want = ALIGN8(new_size);
+    if (p && c && (uint8_t*)p + old == CHUNK_DATA(c) + c->used && want - old <= c->size - c->used) {
+        c->used += want - old;
+        return p;
+    }
+    void* q = arena_alloc(a, new_size);
+    if (q && p) memcpy(q, p, old_size);
+    return q;
+}
+
+arena_mark_t arena_mark(struct arena* a) {
+    arena_mark_t m = { a->top, a->top ? a->top->used : 0 };
+    return m;
+}
+
+void arena_release(struct arena* a, arena_mark_t m) {
+    while (a->top && a->top != m.chunk) {
+        struct arena_chunk* c = a->top;
+        a->top = c->prev;
+        chunk_drop(a, c);
+    }
+    if (a->top) a->top->used = m.used;
+}
+
+void arena_destroy(struct arena* a) {
+    arena_release(a, (arena_mark_t){ 0, 0 });
+    if (a->spare) pmm_free_run((uint32_t)a->spare, a->spare->pages);
+    a->spare = 0;
+}
@@ -0,0 +1,371 @@
+#include "../include/common.h"
+#include "../include/ata.h"
+#include "../include/console.h"
+#include "../include/interrupts.h"
+#include "../include/clock.h"
+#include "../include/timer.h"
+#include "../include/thread.h"
+#include "../include/smp.h"
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+static inline void outl(uint16_t port, uint32_t val) {
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint32_t inl(uint16_t port) {
+    uint32_t ret;
+    __asm__ volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+//primary channel in compatibility mode, which is where qemu's piix ide (and most
+//boards in legacy mode) put it
+#define ATA_IO      0x1F0
+#define ATA_CTRL    0x3F6
+#define ATA_IRQ     14
+#define REG_DATA    0
+#define REG_ERROR   1
+#define REG_COUNT   2
+#define REG_LBA0    3
+#define REG_LBA1    4
+#define REG_LBA2    5
+#define REG_DRIVE   6
+#define REG_STATUS  7 //on read
+#define REG_CMD     7 //on write
+
+#define ST_ERR  0x01
+#define ST_DRQ  0x08
+#define ST_DF   0x20
+#define ST_BSY  0x80
+
+#define CMD_READ_PIO   0x20
+#define CMD_WRITE_PIO  0x30
+#define CMD_READ_DMA   0xC8
+#define CMD_WRITE_DMA  0xCA
+#define CMD_FLUSH      0xE7
+#define CMD_IDENTIFY   0xEC
+
+//bus master registers, offsets from bar4 of the ide controller
+#define BM_CMD     0
+#define BM_STATUS  2
+#define BM_PRDT    4
+#define BM_START   0x01
+#define BM_ACTIVE  0x01 //in the status register
+#define BM_READ    0x08 //device to memory
+#define BM_ERR     0x02
+#define BM_IRQ     0x04
+
+#define PCI_ADDR   0xCF8
+#define PCI_DATA   0xCFC
+
+#define ATA_TIMEOUT_US 2000000
+
+//one prd per piece of the buffer that doesn't cross a 64k boundary, a 256 sector
+//transfer (128k) touches at most three of those
+struct prd {
+    uint32_t addr;
+    uint16_t bytes; //0 means 64k
+    uint16_t flags; //0x8000 on the last one
+} __attribute__((packed));
+
+static struct prd prdt[4] __attribute__((aligned(8)));
+
+static int present = 0;
+static uint32_t sectors = 0;
+static uint16_t bm_base = 0; //0 without bus mastering
+static char model[41];
+
+//what a transfer is waiting on, the irq or the timeout timer sets done and wakes us
+struct ata_wait {
+    volatile int done;
+    volatile int timed_out;
+    struct thread* t;
+};
+
+static struct ata_wait* waiting = 0;
+static volatile int busy = 0;
+static uint32_t reads = 0, writes = 0, dma_ops = 0, pio_ops = 0, errors = 0;
+static uint64_t sectors_moved = 0;
+
+static uint32_t pci_read(uint32_t bus, uint32_t dev, uint32_t fn, uint32_t off) {
+    outl(PCI_ADDR, 0x80000000 | (bus << 16) | (dev << 11) | (fn << 8) | (off & 0xFC));
+    return inl(PCI_DATA);
+}
+
+static void pci_write(uint32_t bus, uint32_t dev, uint32_t fn, uint32_t off, uint32_t val) {
+    outl(PCI_ADDR, 0x80000000 | (bus << 16) | (dev << 11) | (fn << 8) | (off & 0xFC));
+    outl(PCI_DATA, val);
+}
+
+//the ide controller on bus 0 (that's where the chipset puts it), switched to bus mastering.
+//only one in compatibility mode counts, native mode moves the ports somewhere else
+static void find_bus_master(void) {
+    for (uint32_t dev = 0; dev < 32; dev++) {
+        for (uint32_t fn = 0; fn < 8; fn++) {
+            uint32_t id = pci_read(0, dev, fn, 0x00);
+            if ((id & 0xFFFF) == 0xFFFF) {
+                if (fn == 0) break;
+                continue;
+            }
+            uint32_t class = pci_read(0, dev, fn, 0x08);
+            uint8_t progif = class >> 8;
+            if ((class >> 16) != 0x0101 || (progif & 0x01) || !(progif & 0x80)) continue;
+            uint32_t bar4 = pci_read(0, dev, fn, 0x20);
+            if (!(bar4 & 1)) continue; //not an io bar
+            pci_write(0, dev, fn, 0x04, pci_read(0, dev, fn, 0x04) | 0x05); //io space + bus master
+            bm_base = bar4 & 0xFFFC;
+            return;
+        }
+    }
+}
+
+//the 400ns the drive needs after a drive select before its status means anything
+static void delay400(void) {
+    for (int i = 0; i < 4; i++) inb(ATA_CTRL);
+}
+
+static int wait_idle(void) {
+    uint64_t start = clock_us();
+    while (inb(ATA_CTRL) & ST_BSY)
+        if (clock_us() - start > ATA_TIMEOUT_US) return -1;
+    return 0;
+}
+
+static int wait_drq(void) {
+    uint64_t start = clock_us();
+    while (1) {
+        uint8_t st = inb(ATA_CTRL);
+        if (!(st & ST_BSY)) {
+            if (st & (ST_ERR | ST_DF)) return -1;
+            if (st & ST_DRQ) return 0;
+        }
+        if (clock_us() - start > ATA_TIMEOUT_US) return -1;
+    }
+}
+
+static void ata_irq(struct regs* r, void* ctx) {
+    (void)r; (void)ctx;
+    int active = 0;
+    if (bm_base) {
+        uint8_t st = inb(bm_base + BM_STATUS);
+        if (!(st & BM_IRQ)) return;
+        outb(bm_base + BM_STATUS, BM_IRQ); //write one to clear
+        active = st & BM_ACTIVE; //still moving data, not the end of the transfer
+    }
+    inb(ATA_IO + REG_STATUS); //reading it is what acks the drive
+    if (waiting && !active) {
+        waiting->done = 1;
+        if (waiting->t) thread_wake(waiting->t);
+    }
+}
+
+static void ata_timeout(void* arg) {
+    struct ata_wait* w = arg;
+    w->timed_out = 1;
+    if (w->t) thread_wake(w->t);
+}
+
+//one transfer at a time, whoever comes second sleeps until the disk is free
+static void ata_acquire(void) {
+    while (__atomic_exchange_n(&busy, 1, __ATOMIC_ACQUIRE)) sleep_us(1000);
+}
+
+static void ata_release(void) {
+    __atomic_store_n(&busy, 0, __ATOMIC_RELEASE);
+}
+
+static void select_lba(uint32_t lba, uint32_t count) {
+    outb(ATA_IO + REG_DRIVE, 0xE0 | ((lba >> 24) & 0x0F));
+    delay400();
+    outb(ATA_IO + REG_COUNT, count & 0xFF); //0 means 256
+    outb(ATA_IO + REG_LBA0, lba);
+    outb(ATA_IO + REG_LBA1, lba >> 8);
+    outb(ATA_IO + REG_LBA2, lba >> 16);
+}
+
+static int pio_transfer(uint32_t lba, uint32_t count, uint8_t* buf, int write) {
+    if (wait_idle() < 0) return -1;
+    select_lba(lba, count);
+    outb(ATA_IO + REG_CMD, write ? CMD_WRITE_PIO : CMD_READ_PIO);
+    for (uint32_t i = 0; i < count; i++) {
+        if (wait_drq() < 0) return -1;
+        uint32_t words = ATA_SECTOR / 2;
+        //the string ops move buf along a sector for us
+        if (write) __asm__ volatile ("rep outsw" : "+S"(buf), "+c"(words) : "d"(ATA_IO + REG_DATA) : "memory");
+        else __asm__ volatile ("rep insw" : "+D"(buf), "+c"(words) : "d"(ATA_IO + REG_DATA) : "memory");
+    }
+    if (wait_idle() < 0) return -1;
+    pio_ops++;
+    return inb(ATA_CTRL) & (ST_ERR | ST_DF) ? -1 : 0;
+}
+
+//the buffer is identity mapped like everything else, so its address is what the
+//controller gets. we block until the irq instead of spinning on the status register
+static int dma_transfer(uint32_t lba, uint32_t count, uint8_t* buf, int write) {
+    uint32_t addr = (uint32_t)buf, left = count * ATA_SECTOR, n = 0;
+    while (left) {
+        uint32_t piece = 0x10000 - (addr & 0xFFFF);
+        if (piece > left) piece = left;
+        prdt[n].addr = addr;
+        prdt[n].bytes = piece & 0xFFFF;
+        prdt[n].flags = 0;
+        addr += piece;
+        left -= piece;
+        n++;
+    }
+    prdt[n - 1].flags = 0x8000;
+
+    if (wait_idle() < 0) return -1;
+    inb(ATA_IO + REG_STATUS); //drops anything a pio transfer left pending
+    outb(bm_base + BM_CMD, 0);
+    outl(bm_base + BM_PRDT, (uint32_t)prdt);
+    outb(bm_base + BM_STATUS, BM_ERR | BM_IRQ);
+    outb(bm_base + BM_CMD, write ? 0 : BM_READ);
+
+    struct ata_wait w = { 0, 0, this_cpu()->current };
+    struct timer t;
+    timer_setup(&t, ata_timeout, &w);
+    waiting = &w;
+    timer_add_us(&t, ATA_TIMEOUT_US);
+
+    select_lba(lba, count);
+    outb(ATA_IO + REG_CMD, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+    outb(bm_base + BM_CMD, (write ? 0 : BM_READ) | BM_START);
+
+    //interrupts stay off from the check until we block (or cpu_idle's sti; hlt), same as sleep_us
+    while (1) {
+        __asm__ volatile ("cli");
+        if (w.done || w.timed_out) break;
+        if (w.t) thread_block();
+        else cpu_idle();
+    }
+    waiting = 0;
+    __asm__ volatile ("sti");
+    timer_del(&t);
+
+    outb(bm_base + BM_CMD, 0);
+    uint8_t bm = inb(bm_base + BM_STATUS);
+    outb(bm_base + BM_STATUS, BM_ERR | BM_IRQ);
+    if (w.timed_out && !w.done) return -1;
+    dma_ops++;
+    return (bm & BM_ERR) || (inb(ATA_CTRL) & (ST_ERR | ST_DF)) ? -1 : 0;
+}
+
+static int transfer(uint32_t lba, uint32_t count, uint8_t* buf, int write) {
+    if (!present || lba + count > sectors || lba + count < lba) return -1;
+    ata_acquire();
+    int ret = 0;
+    while (count && ret == 0) {
+        uint32_t n = count > 256 ? 256 : count;
+        //prds need an even address
+        if (bm_base && !((uint32_t)buf & 1)) ret = dma_transfer(lba, n, buf, write);
+        else ret = pio_transfer(lba, n, buf, write);
+        lba += n;
+        count -= n;
+        buf += n * ATA_SECTOR;
+        sectors_moved += n;
+    }
+    if (ret < 0) errors++;
+    ata_release();
+    return ret;
+}
+
+int ata_read(uint32_t lba, uint32_t count, void* buf) {
+    reads++;
+    return transfer(lba, count, buf, 0);
+}
+
+int ata_write(uint32_t lba, uint32_t count, const void* buf) {
+    writes++;
+    return transfer(lba, count, (uint8_t*)buf, 1);
+}
+
+int ata_flush(void) {
+    if (!present) return -1;
+    ata_acquire();
+    int ret = wait_idle();
+    if (ret == 0) {
+        outb(ATA_IO + REG_DRIVE, 0xE0);
+        delay400();
+        outb(ATA_IO + REG_CMD, CMD_FLUSH);
+        ret = wait_idle() < 0 || (inb(ATA_CTRL) & (ST_ERR | ST_DF)) ? -1 : 0;
+    }
+    if (ret < 0) errors++;
+    ata_release();
+    return ret;
+}
+
+int ata_init(void) {
+    outb(ATA_CTRL, 0); //interrupts on
+    outb(ATA_IO + REG_DRIVE, 0xA0);
+    delay400();
+    if (inb(ATA_IO + REG_STATUS) == 0xFF) return -1; //floating bus, no channel at all
+
+    outb(ATA_IO + REG_COUNT, 0);
+    outb(ATA_IO + REG_LBA0, 0);
+    outb(ATA_IO + REG_LBA1, 0);
+    outb(ATA_IO + REG_LBA2, 0);
+    outb(ATA_IO + REG_CMD, CMD_IDENTIFY);
+    if (inb(ATA_IO + REG_STATUS) == 0) return -1;
+    if (wait_idle() < 0) return -1;
+    //atapi and sata drives answer with a signature in the lba registers instead
+    if (inb(ATA_IO + REG_LBA1) || inb(ATA_IO + REG_LBA2)) return -1;
+    if (wait_drq() < 0) return -1;
+
+    uint16_t id[256];
+    for (int i = 0; i < 256; i++) {
+        uint16_t w;
+        __asm__ volatile ("inw %1, %0" : "=a"(w) : "Nd"((uint16_t)(ATA_IO + REG_DATA)));
+        id[i] = w;
+    }
+    if (!(id[49] & 0x200)) return -1; //no lba
+    sectors = id[60] | ((uint32_t)id[61] << 16);
+    //the model string is byte swapped within each word
+    for (int i = 0; i < 20; i++) {
+        model[i * 2] = id[27 + i] >> 8;
+        model[i * 2 + 1] = id[27 + i] & 0xFF;
+    }
+    model[40] = 0;
+    for (int i = 39; i >= 0 && model[i] == ' '; i--) model[i] = 0;
+
+    if (id[49] & 0x100) find_bus_master();
+    irq_register(ATA_IRQ, ata_irq, 0);
+    present = 1;
+    return 0;
+}
+
+int ata_present(void) {
+    return present;
+}
+
+uint32_t ata_sectors(void) {
+    return sectors;
+}
+
+void ata_print(void) {
+    if (!present) { puts("no ata disk\n"); return; }
+    puts("disk: ");
+    puts(model);
+    puts(", ");
+    print_uint(sectors >> 11);
+    puts(" MB, ");
+    puts(bm_base ? "bus master dma\n" : "pio only\n");
+    print_uint(reads);
+    puts(" reads, ");
+    print_uint(writes);
+    puts(" writes, ");
+    print_uint64(sectors_moved);
+    puts(" sectors (");
+    print_uint(dma_ops);
+    puts(" dma, ");
+    print_uint(pio_ops);
+    puts(" pio), ");
+    print_uint(errors);
+    puts(" errors\n");
+}
@@ -0,0 +1,211 @@
+#include "../include/common.h"
+#include "../include/clock.h"
+#include "../include/interrupts.h"
+#include "../include/spinlock.h"
+
+//our timer system
+#define HPET_BASE          0xFED00000 
+#define HPET_CAP_LOW       (*(volatile uint32_t*)(HPET_BASE + 0x00)) 
+#define HPET_CAP_HIGH      (*(volatile uint32_t*)(HPET_BASE + 0x04)) //tick period in femtoseconds
+#define HPET_CONFIG_LOW    (*(volatile uint32_t*)(HPET_BASE + 0x10)) 
+#define HPET_COUNTER_LOW   (*(volatile uint32_t*)(HPET_BASE + 0xF0)) //counter register
+#define HPET_COUNTER_HIGH  (*(volatile uint32_t*)(HPET_BASE + 0xF4)) //upper half of the counter on 64 bit hpets
+
+#define HPET_CAP_COUNT_SIZE (1 << 13) //set if the main counter is 64 bits wide
+#define HPET_CAP_LEG_RT     (1 << 15) //timer 0/1 can take over the pit/rtc irqs
+#define HPET_CAP_NUM_TIM(c) ((((c) >> 8) & 0x1F) + 1)
+
+#define HPET_CFG_ENABLE     (1 << 0)
+#define HPET_CFG_LEG_RT     (1 << 1) //timer 0 -> irq0, timer 1 -> irq8
+
+//per timer (comparator) registers, each timer gets 0x20 bytes starting at 0x100
+#define HPET_TIMER_CONFIG(n)     (*(volatile uint32_t*)(HPET_BASE + 0x100 + 0x20 * (n)))
+#define HPET_TIMER_CMP_LOW(n)    (*(volatile uint32_t*)(HPET_BASE + 0x108 + 0x20 * (n)))
+#define HPET_TIMER_CMP_HIGH(n)   (*(volatile uint32_t*)(HPET_BASE + 0x10C + 0x20 * (n)))
+
+#define HPET_TN_LEVEL       (1 << 1) //0 = edge triggered
+#define HPET_TN_INT_ENB     (1 << 2)
+#define HPET_TN_PERIODIC    (1 << 3) //0 = one-shot
+#define HPET_TN_SIZE_CAP    (1 << 5) //comparator is 64 bits wide
+#define HPET_TN_32MODE      (1 << 8)
+
+#define HPET_MIN_DELTA_NS   2000           //anything closer than this is treated as already due
+#define HPET_MAX_DELTA_NS   10000000000ULL //a 32 bit counter has to be read before it wraps
+
+//ticks are turned into nanoseconds with ns = (ticks * mult) >> CLOCK_SHIFT
+//the hpet period is at most 100ns so 100 << 24 still fits in 32 bits
+#define CLOCK_SHIFT 24
+#define TSC_CALIBRATE_NS 10000000 //10ms
+
+//timer variables
+static uint32_t hpet_mult = 0;
+static uint32_t hpet_inv_mult = 0; //ns -> ticks, for programming the comparator
+static int hpet_oneshot = 0;
+static int hpet_64bit = 0;
+static uint32_t last_low = 0;   //only used to extend a 32 bit counter
+static uint32_t high_epoch = 0;
+static spinlock_t epoch_lock = SPINLOCK_INIT; //every cpu reads the clock, one wrap must only count once
+
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_inv_mult = 0; //ns -> cycles, for the tsc deadline timer
+static uint32_t tsc_freq_khz = 0;
+static int tsc_invariant = 0;
+static uint64_t tsc_base = 0;
+static uint64_t tsc_base_ns = 0;
+
+//64 bit ticks times a 32 bit multiplier, shifted down, without losing the top bits
+static inline uint64_t scale(uint64_t ticks, uint32_t mult) {
+    uint64_t lo = (uint64_t)(uint32_t)ticks * mult;
+    uint64_t hi = (ticks >> 32) * mult;
+    return (hi << (32 - CLOCK_SHIFT)) + (lo >> CLOCK_SHIFT);
+}
+
+//reads the whole counter, re-reading the high half in case the low half rolled over in between
+uint64_t hpet_read(void) {
+    if (hpet_64bit) {
+        uint32_t hi, lo;
+        do {
+            hi = HPET_COUNTER_HIGH;
+            lo = HPET_COUNTER_LOW;
+        } while (hi != HPET_COUNTER_HIGH);
+        return ((uint64_t)hi << 32) | lo;
+    }
+
+    //32 bit counter, count the wraps ourselves. the counter is read under the lock too,
+    //otherwise a cpu holding an older value would see it as a wrap
+    uint32_t flags = spin_lock_irqsave(&epoch_lock);
+    uint32_t lo = HPET_COUNTER_LOW;
+    if (lo < last_low) high_epoch++;
+    last_low = lo;
+    uint64_t now = ((uint64_t)high_epoch << 32) | lo;
+    spin_unlock_irqrestore(&epoch_lock, flags);
+    return now;
+}
+
+static uint64_t hpet_ns(void) {
+    return scale(hpet_read(), hpet_mult);
+}
+
+//measures the tsc against the hpet, only used as the clock source if it is invariant
+static void tsc_calibrate(void) {
+    uint32_t a, b, c, d;
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a >= 0x80000007) {
+        cpuid(0x80000007, &a, &b, &c, &d);
+        if (d & (1 << 8)) tsc_invariant = 1;
+    }
+
+    uint64_t h0 = hpet_ns();
+    uint64_t t0 = rdtsc();
+    uint64_t h1;
+    do { h1 = hpet_ns(); } while (h1 - h0 < TSC_CALIBRATE_NS);
+    uint64_t t1 = rdtsc();
+
+    uint64_t cycles = t1 - t0;
+    uint64_t ns = h1 - h0;
+    //slower than ~4MHz or a broken tsc, don't trust it
+    if (cycles < 40000 || (cycles >> 32)) { tsc_invariant = 0; return; }
+
+    uint64_t mult = div64_u32(ns << CLOCK_SHIFT, (uint32_t)cycles, 0);
+    if (mult >> 32) { tsc_invariant = 0; return; }
+    tsc_mult = (uint32_t)mult;
+    tsc_inv_mult = (uint32_t)div64_u32(cycles << CLOCK_SHIFT, (uint32_t)ns, 0);
+    tsc_freq_khz = (uint32_t)div64_u32(cycles * 1000000, (uint32_t)ns, 0);
+
+    tsc_base = rdtsc();
+    tsc_base_ns = hpet_ns();
+}
+
+//initialize the timer, works out the fixed point multipliers once so reads never divide
+void hpet_init(void) {
+    HPET_CONFIG_LOW |= 1;
+
+    uint32_t period_fs = HPET_CAP_HIGH;
+    hpet_64bit = (HPET_CAP_LOW & HPET_CAP_COUNT_SIZE) != 0;
+
+    //period_fs / 1e6 is ns per tick
+    hpet_mult = (uint32_t)div64_u32((uint64_t)period_fs << CLOCK_SHIFT, 1000000, 0);
+    hpet_inv_mult = (uint32_t)div64_u32(1000000ULL << CLOCK_SHIFT, period_fs, 0);
+
+    last_low = HPET_COUNTER_LOW;
+    high_epoch = 0;
+
+    tsc_calibrate();
+}
+
+//sets comparator 0 up as a one-shot deadline timer on irq0 (legacy replacement mode)
+//returns 0 if this hpet can't do it and the caller should keep the pit ticking instead
+int hpet_oneshot_init(void) {
+    uint32_t cap = HPET_CAP_LOW;
+    if (!hpet_mult || !(cap & HPET_CAP_LEG_RT) || HPET_CAP_NUM_TIM(cap) < 1) return 0;
+
+    uint32_t cfg = HPET_TIMER_CONFIG(0);
+    cfg &= ~(HPET_TN_LEVEL | HPET_TN_PERIODIC | HPET_TN_INT_ENB | HPET_TN_32MODE);
+    if (!hpet_64bit || !(cfg & HPET_TN_SIZE_CAP)) cfg |= HPET_TN_32MODE;
+    HPET_TIMER_CONFIG(0) = cfg;
+
+    //park the comparator as far away as possible before turning the interrupt on
+    HPET_TIMER_CMP_LOW(0) = 0xFFFFFFFF;
+    HPET_TIMER_CMP_HIGH(0) = 0xFFFFFFFF;
+
+    HPET_CONFIG_LOW |= HPET_CFG_LEG_RT | HPET_CFG_ENABLE;
+    HPET_TIMER_CONFIG(0) = cfg | HPET_TN_INT_ENB;
+    hpet_oneshot = 1;
+    return 1;
+}
+
+//arms comparator 0 for a clock_ns() deadline. returns -1 if the deadline is already
+//(or too close to) passed, in that case no interrupt is coming and the caller has to handle it
+int hpet_arm(uint64_t deadline_ns) {
+    if (!hpet_oneshot) return -1;
+
+    uint64_t now_ns = clock_ns();
+    if ((int64_t)(deadline_ns - now_ns) < HPET_MIN_DELTA_NS) return -1;
+
+    uint64_t delta_ns = deadline_ns - now_ns;
+    if (!hpet_64bit && delta_ns > HPET_MAX_DELTA_NS) delta_ns = HPET_MAX_DELTA_NS;
+
+    uint32_t flags = irq_save();
+    uint64_t cmp = hpet_read() + scale(delta_ns, hpet_inv_mult);
+    HPET_TIMER_CMP_LOW(0) = (uint32_t)cmp;
+    HPET_TIMER_CMP_HIGH(0) = (uint32_t)(cmp >> 32);
+
+    //an edge is only raised when the counter crosses the comparator, so check we didn't lose the race
+    int64_t left = (int64_t)(cmp - hpet_read());
+    if (!hpet_64bit) left = (int32_t)((uint32_t)cmp - HPET_COUNTER_LOW);
+    irq_restore(flags);
+
+    return left > 0 ? 0 : -1;
+}
+
+//nanoseconds since the hpet was enabled
+uint64_t clock_ns(void) {
+    if (tsc_invariant) return tsc_base_ns + scale(rdtsc() - tsc_base, tsc_mult);
+    return hpet_ns();
+}
+
+uint64_t clock_us(void) {
+    return div64_u32(clock_ns(), 1000, 0);
+}
+
+uint32_t uptime_seconds(void) {
+    return (uint32_t)div64_u32(clock_ns(), 1000000000, 0);
+}
+
+uint64_t tsc_to_ns(uint64_t cycles) {
+    return scale(cycles, tsc_mult);
+}
+
+//the tsc value at which clock_ns() will read deadline_ns, only meaningful when clock_uses_tsc()
+uint64_t clock_ns_to_tsc(uint64_t deadline_ns) {
+    if (deadline_ns < tsc_base_ns) return tsc_base;
+    return tsc_base + scale(deadline_ns - tsc_base_ns, tsc_inv_mult);
+}
+
+uint32_t tsc_khz(void) {
+    return tsc_freq_khz;
+}
+
+int clock_uses_tsc(void) {
+    return tsc_invariant;
+}
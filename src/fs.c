@@ -0,0 +1,1135 @@
+#include "../include/common.h"
+#include "../include/fs.h"
+#include "../include/string.h"
+#include "../include/console.h"
+#include "../include/trace.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/spinlock.h"
+#include "../include/ata.h"
+#include "../include/timer.h"
+
+//Our filesystem, make sure to understand it as it is probably the most directly related to the class
+//I will cover this the most
+
+//the index is open addressing with linear probing over power of two slots, keyed on the
+//directory and the name, so finding one path component is one probe. a slot keeps the
+//key's hash next to the file, so a probe only runs strcmp when the hashes already match.
+//removed files leave a tombstone so later probes keep going past them
+#define INDEX_MIN  128
+#define TOMBSTONE  ((file_t*)1)
+#define TABLE_MIN  64
+#define NO_SLOT    0xFFFFFFFF
+#define COMPACT_MIN 64 //tombstones it takes before compaction is worth a pass
+#define DCACHE_SIZE 256
+
+struct index_slot {
+    uint32_t hash;
+    file_t* f;
+};
+
+static struct kmem_cache* file_cache;
+//the file table. a file keeps its slot for life, so a handle (slot and generation) stays
+//good until that file is removed. rm leaves a tombstone (f == 0) and pushes the slot on the
+//free list, creates pop from it before growing the table
+struct file_slot {
+    file_t* f;
+    uint32_t next_free;
+};
+
+static struct file_slot* files;
+static uint32_t file_count = 0;     //live files
+static uint32_t table_len = 0;      //slots ever handed out, live or tombstone
+static uint32_t file_cap = 0;
+static uint32_t dead = 0;           //tombstones below table_len
+static uint32_t compact_at = COMPACT_MIN; //dead count that earns the next compaction
+static uint32_t free_head = NO_SLOT;
+static uint32_t next_gen = 1;
+static struct index_slot* name_index;
+static uint32_t index_cap = 0;
+static uint32_t index_used = 0;     //live entries and tombstones, what the probes have to walk over
+static uint32_t block_map[FS_BLOCKS / 32]; //a set bit is a used block
+static uint32_t blocks_free = FS_BLOCKS;
+static uint32_t extent_total = 0;
+static file_t* root;
+static file_t* cwd;
+static char cwd_path[FS_PATH_MAX]; //"" is the root, otherwise /a/b
+static spinlock_t fs_lock = SPINLOCK_INIT;
+
+//whole paths already resolved, direct mapped on the path's hash. a hit skips the walk
+//entirely. a positive entry holds a handle, so a removed file just stops matching; it
+//also has to be from the current pos_epoch, which renames bump since they move whole
+//subtrees. a negative entry (gen 0) says the path doesn't exist until anything is created
+struct dentry {
+    uint32_t hash;
+    uint32_t epoch;
+    fs_handle_t h;
+    char* path;     //kmalloc'd
+};
+
+static struct dentry dcache[DCACHE_SIZE];
+static uint32_t pos_epoch = 1, neg_epoch = 1;
+static uint32_t dc_hits = 0, dc_neg_hits = 0, dc_misses = 0;
+
+//fnv-1a, short names and no multiplies worth worrying about
+static uint32_t name_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) { h ^= (uint8_t)*s++; h *= 16777619u; }
+    return h;
+}
+
+//both tables get past what kmalloc does quickly, so they are whole pages
+static void* pages_alloc(uint32_t bytes) {
+    uint32_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    void* p = (void*)pmm_alloc_run(pages);
+    if (p) memset(p, 0, pages * PAGE_SIZE);
+    return p;
+}
+
+static void pages_free(void* p, uint32_t bytes) {
+    if (p) pmm_free_run((uint32_t)p, (bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+//directories are told apart by generation, which is never reused
+static uint32_t entry_hash(const file_t* dir, const char* name) {
+    return name_hash(name) ^ (dir->gen * 0x9E3779B1u);
+}
+
+static struct index_slot* index_find(const file_t* dir, const char* name, uint32_t h) {
+    uint32_t mask = index_cap - 1;
+    for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+        struct index_slot* s = &name_index[i];
+        if (!s->f) return 0;
+        if (s->f != TOMBSTONE && s->hash == h && s->f->parent == dir && strcmp(s->f->name, name) == 0) return s;
+    }
+}
+
+static void index_put(struct index_slot* tab, uint32_t cap, uint32_t h, file_t* f) {
+    uint32_t mask = cap - 1;
+    uint32_t i = h & mask;
+    while (tab[i].f && tab[i].f != TOMBSTONE) i = (i + 1) & mask;
+    tab[i].hash = h;
+    tab[i].f = f;
+}
+
+//rebuilt at twice the size when it's the files filling it, the same size when it's tombstones
+static int index_rehash(void) {
+    uint32_t cap = index_cap ? index_cap : INDEX_MIN;
+    while (file_count * 2 >= cap) cap *= 2;
+    struct index_slot* tab = pages_alloc(cap * sizeof(struct index_slot));
+    if (!tab) return -1;
+    for (uint32_t i = 0; i < index_cap; i++)
+        if (name_index[i].f && name_index[i].f != TOMBSTONE) index_put(tab, cap, name_index[i].hash, name_index[i].f);
+    pages_free(name_index, index_cap * sizeof(struct index_slot));
+    name_index = tab;
+    index_cap = cap;
+    index_used = file_count;
+    return 0;
+}
+
+static int table_resize(uint32_t cap) {
+    struct file_slot* tab = pages_alloc(cap * sizeof(struct file_slot));
+    if (!tab) return -1;
+    memcpy(tab, files, table_len * sizeof(struct file_slot));
+    pages_free(files, file_cap * sizeof(struct file_slot));
+    files = tab;
+    file_cap = cap;
+    return 0;
+}
+
+//slots never move, so compacting means dropping the tombstones at the end of the table,
+//giving back memory the table doesn't need any more, and rebuilding the free list lowest
+//slot first so new files fill the holes near the front. it's a full pass, so it only runs
+//once over half the table is tombstones, and tombstones stuck in front of live files don't
+//count twice: the next pass waits until dead has doubled from what this one left, so every
+//pass is paid for by at least as many removes as it walks slots
+static void table_compact(void) {
+    while (table_len && !files[table_len - 1].f) table_len--;
+    free_head = NO_SLOT;
+    dead = 0;
+    for (uint32_t i = table_len; i-- > 0;) {
+        if (files[i].f) continue;
+        files[i].next_free = free_head;
+        free_head = i;
+        dead++;
+    }
+    compact_at = dead * 2 > COMPACT_MIN ? dead * 2 : COMPACT_MIN;
+    if (compact_at > table_len) compact_at = table_len; //a table of nothing but tombstones is always worth trimming
+    uint32_t cap = file_cap;
+    while (cap > TABLE_MIN && table_len * 4 <= cap) cap /= 2;
+    if (cap != file_cap) table_resize(cap);
+}
+
+//0 means out of memory, an unused slot otherwise
+static int slot_take(uint32_t* slot) {
+    if (free_head != NO_SLOT) {
+        *slot = free_head;
+        free_head = files[free_head].next_free;
+        dead--;
+        return 0;
+    }
+    if (table_len == file_cap && table_resize(file_cap ? file_cap * 2 : TABLE_MIN) < 0) return -1;
+    *slot = table_len++;
+    return 0;
+}
+
+//extents. the block bitmap is scanned for free runs a word at a time where it can be
+//(a full or empty word is 32 blocks of the same thing), and the smallest run that holds
+//the whole request wins, so small files fill small holes and big runs stay big
+static inline int block_used(uint32_t b) {
+    return (block_map[b >> 5] >> (b & 31)) & 1;
+}
+
+static void run_mark(uint32_t start, uint32_t count, int used) {
+    for (uint32_t b = start; b < start + count; b++) {
+        if (used) block_map[b >> 5] |= 1u << (b & 31);
+        else block_map[b >> 5] &= ~(1u << (b & 31));
+    }
+    if (used) blocks_free -= count;
+    else blocks_free += count;
+}
+
+//best fit for want blocks. when nothing is that big it hands back the longest run there
+//is, *got says how long the returned run is, 0 if the region is full
+static uint32_t run_find(uint32_t want, uint32_t* got) {
+    uint32_t best = 0, best_len = 0, run_start = 0, run_len = 0;
+    uint32_t b = 0;
+    while (b <= FS_BLOCKS) {
+        int used;
+        uint32_t step = 1;
+        if (b == FS_BLOCKS) used = 1; //closes the last run
+        else if ((b & 31) == 0 && block_map[b >> 5] == ~0u) { used = 1; step = 32; }
+        else if ((b & 31) == 0 && block_map[b >> 5] == 0) { used = 0; step = 32; }
+        else used = block_used(b);
+
+        if (!used) {
+            if (!run_len) run_start = b;
+            run_len += step;
+        } else if (run_len) {
+            int fits = run_len >= want, best_fits = best_len >= want;
+            if ((fits && (!best_fits || run_len < best_len)) || (!fits && !best_fits && run_len > best_len)) {
+                best = run_start;
+                best_len = run_len;
+                if (run_len == want) break;
+            }
+            run_len = 0;
+        }
+        b += step;
+    }
+    *got = best_len;
+    return best;
+}
+
+static uint32_t file_blocks(const file_t* f) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < f->ext_count; i++) n += f->ext[i].count;
+    return n;
+}
+
+static int ext_push(file_t* f, uint32_t start, uint32_t count) {
+    struct extent* last = f->ext_count ? &f->ext[f->ext_count - 1] : 0;
+    if (last && last->start + last->count == start) { last->count += count; return 0; }
+    if (f->ext_count == f->ext_cap) {
+        uint32_t cap = f->ext_cap ? f->ext_cap * 2 : 2;
+        if (cap > KMALLOC_MAX / sizeof(struct extent)) cap = KMALLOC_MAX / sizeof(struct extent);
+        if (cap == f->ext_cap) return -1;
+        struct extent* e = kmalloc(cap * sizeof(struct extent));
+        if (!e) return -1;
+        memcpy(e, f->ext, f->ext_count * sizeof(struct extent));
+        kfree(f->ext);
+        f->ext = e;
+        f->ext_cap = cap;
+    }
+    f->ext[f->ext_count].start = start;
+    f->ext[f->ext_count].count = count;
+    f->ext_count++;
+    extent_total++;
+    return 0;
+}
+
+//adds need blocks to the end of the file: straight after its last extent if those are
+//free, best fit for the rest. the caller has checked there are that many free blocks
+static int file_extend(file_t* f, uint32_t need) {
+    if (f->ext_count) {
+        struct extent* last = &f->ext[f->ext_count - 1];
+        uint32_t b = last->start + last->count, n = 0;
+        while (n < need && b + n < FS_BLOCKS && !block_used(b + n)) n++;
+        if (n) { run_mark(b, n, 1); last->count += n; need -= n; }
+    }
+    while (need) {
+        uint32_t got;
+        uint32_t start = run_find(need, &got);
+        if (!got) return -1;
+        if (got > need) got = need;
+        if (ext_push(f, start, got) < 0) return -1;
+        run_mark(start, got, 1);
+        need -= got;
+    }
+    return 0;
+}
+
+static void file_truncate(file_t* f) {
+    for (uint32_t i = 0; i < f->ext_count; i++) run_mark(f->ext[i].start, f->ext[i].count, 0);
+    extent_total -= f->ext_count;
+    f->ext_count = 0;
+    f->size = 0;
+}
+
+static inline uint8_t* block_addr(uint32_t b) {
+    return (uint8_t*)(FS_START_ADDR + b * FS_BLOCK);
+}
+
+//copies into the file's blocks from offset on, the blocks have to be there already
+static void copy_in(file_t* f, uint32_t offset, const uint8_t* src, uint32_t len) {
+    for (uint32_t i = 0; i < f->ext_count && len; i++) {
+        uint32_t bytes = f->ext[i].count * FS_BLOCK;
+        if (offset >= bytes) { offset -= bytes; continue; }
+        uint32_t n = bytes - offset < len ? bytes - offset : len;
+        if (src) memcpy(block_addr(f->ext[i].start) + offset, src, n);
+        else memset(block_addr(f->ext[i].start) + offset, 0, n);
+        if (src) src += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+static file_t* handle_get(fs_handle_t h) {
+    file_t* f = h.slot < table_len ? files[h.slot].f : 0;
+    return f && f->gen == h.gen ? f : 0;
+}
+
+//writers copy into a file's blocks with fs_lock dropped. the pin keeps rm from freeing the
+//file (or its blocks) under them, and the writing flag keeps two of them from both
+//working from the same size. -1 if the file is already gone
+static int writer_enter(file_t* f) {
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    int live = f->slot < table_len && files[f->slot].f == f;
+    if (live) f->pins++;
+    spin_unlock_irqrestore(&fs_lock, flags);
+    if (!live) return -1;
+    while (__atomic_exchange_n(&f->writing, 1, __ATOMIC_ACQUIRE)) sleep_us(100);
+    return 0;
+}
+
+static void writer_exit(file_t* f) {
+    __atomic_store_n(&f->writing, 0, __ATOMIC_RELEASE);
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    int last = --f->pins == 0 && f->removed;
+    if (last) file_truncate(f);
+    spin_unlock_irqrestore(&fs_lock, flags);
+    if (last) {
+        kfree(f->ext);
+        kmem_cache_free(file_cache, f);
+    }
+}
+
+static void child_link(file_t* dir, file_t* f) {
+    f->parent = dir;
+    f->next = 0;
+    f->prev = dir->last_child;
+    if (dir->last_child) dir->last_child->next = f;
+    else dir->first_child = f;
+    dir->last_child = f;
+    dir->children++;
+}
+
+static void child_unlink(file_t* f) {
+    file_t* dir = f->parent;
+    if (f->prev) f->prev->next = f->next;
+    else dir->first_child = f->next;
+    if (f->next) f->next->prev = f->prev;
+    else dir->last_child = f->prev;
+    dir->children--;
+}
+
+//absolute, with . and .. worked out and every component cut to MAX_NAME - 1 like the
+//stored names are. the root comes out as "". -1 when it doesn't fit in FS_PATH_MAX
+static int path_canon(const char* path, char* out) {
+    uint32_t len = 0;
+    if (*path != '/') {
+        len = strlen(cwd_path);
+        memcpy(out, cwd_path, len);
+    }
+    out[len] = 0;
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+        const char* c = path;
+        uint32_t n = 0;
+        while (path[n] && path[n] != '/') n++;
+        path += n;
+        if (n == 1 && c[0] == '.') continue;
+        if (n == 2 && c[0] == '.' && c[1] == '.') {
+            while (len && out[len - 1] != '/') len--;
+            if (len) len--;
+            out[len] = 0;
+            continue;
+        }
+        if (n > MAX_NAME - 1) n = MAX_NAME - 1;
+        if (len + 1 + n >= FS_PATH_MAX) return -1;
+        out[len++] = '/';
+        memcpy(out + len, c, n);
+        len += n;
+        out[len] = 0;
+    }
+    return len;
+}
+
+//cuts the last component off a canonical path into name, -1 if there isn't one (the root)
+static int path_split(char* canon, char* name) {
+    int len = strlen(canon);
+    if (!len) return -1;
+    int i = len;
+    while (canon[i - 1] != '/') i--;
+    memcpy(name, canon + i, len - i + 1);
+    canon[i - 1] = 0;
+    return 0;
+}
+
+//one index probe per component
+static file_t* walk(const char* p) {
+    file_t* d = root;
+    while (*p) {
+        char name[MAX_NAME];
+        uint32_t n = 0;
+        p++;
+        while (*p && *p != '/') name[n++] = *p++;
+        name[n] = 0;
+        if (!d->is_dir) return 0;
+        struct index_slot* s = index_find(d, name, entry_hash(d, name));
+        if (!s) return 0;
+        d = s->f;
+    }
+    return d;
+}
+
+//a canonical path to its file through the dentry cache, fs_lock held
+static file_t* resolve(const char* canon) {
+    uint32_t h = name_hash(canon);
+    struct dentry* d = &dcache[h & (DCACHE_SIZE - 1)];
+    int same = d->path && d->hash == h && strcmp(d->path, canon) == 0;
+    if (same && !d->h.gen && d->epoch == neg_epoch) { dc_neg_hits++; return 0; }
+    if (same && d->h.gen && d->epoch == pos_epoch) {
+        file_t* f = handle_get(d->h);
+        if (f) { dc_hits++; return f; }
+    }
+
+    dc_misses++;
+    file_t* f = walk(canon);
+    if (!same) {
+        char* copy = kstrdup(canon);
+        if (!copy) return f;
+        kfree(d->path);
+        d->path = copy;
+        d->hash = h;
+    }
+    if (f) { d->h = fs_handle(f); d->epoch = pos_epoch; }
+    else { d->h.slot = d->h.gen = 0; d->epoch = neg_epoch; }
+    return f;
+}
+
+static void cwd_refresh(void) {
+    char tmp[FS_PATH_MAX];
+    int pos = FS_PATH_MAX - 1;
+    tmp[pos] = 0;
+    for (file_t* d = cwd; d != root; d = d->parent) {
+        int n = strlen(d->name);
+        if (pos - n - 1 < 0) { cwd = root; cwd_path[0] = 0; return; } //moved somewhere too deep to name
+        pos -= n;
+        memcpy(tmp + pos, d->name, n);
+        tmp[--pos] = '/';
+    }
+    memcpy(cwd_path, tmp + pos, FS_PATH_MAX - pos);
+}
+
+file_t* fs_lookup(const char* path) {
+    char canon[FS_PATH_MAX];
+    if (path_canon(path, canon) < 0) return 0;
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    file_t* f = resolve(canon);
+    spin_unlock_irqrestore(&fs_lock, flags);
+    TRACE(TRACE_FIND_FILE, trace_tag(path), f != 0);
+    return f;
+}
+
+//looks up a file by path, a cache hit is one hash and one probe whatever the depth
+file_t* find_file(const char* path) {
+    file_t* f = fs_lookup(path);
+    return f && !f->is_dir ? f : 0;
+}
+
+const char* fs_strerror(int err) {
+    switch (err) {
+    case FS_NOT_FOUND: return "no such file or directory";
+    case FS_EXISTS:    return "already exists";
+    case FS_NOT_EMPTY: return "directory not empty";
+    case FS_BUSY:      return "in use";
+    case FS_NOT_DIR:   return "not a directory";
+    case FS_BAD_PATH:  return "bad path";
+    case FS_NO_DISK:   return "no disk";
+    case FS_IO:        return "disk error";
+    case FS_NO_SPACE:  return "no space left on disk";
+    }
+    return "error";
+}
+
+//gives a new (named, not yet linked) file its blocks, a table slot and an index entry in dir,
+//fs_lock held. -1 if the name is taken or something is out of room, f is left for the caller to free
+static int node_attach(file_t* dir, file_t* f, uint32_t size) {
+    uint32_t h = entry_hash(dir, f->name);
+    if (!dir->is_dir || index_find(dir, f->name, h)
+        || ((index_used + 1) * 4 > index_cap * 3 && index_rehash() < 0)
+        || (size + FS_BLOCK - 1) / FS_BLOCK > blocks_free
+        || file_extend(f, (size + FS_BLOCK - 1) / FS_BLOCK) < 0
+        || slot_take(&f->slot) < 0) {
+        file_truncate(f);
+        return -1;
+    }
+    f->gen = next_gen++;
+    files[f->slot].f = f;
+    file_count++;
+    child_link(dir, f);
+    index_put(name_index, index_cap, h, f);
+    index_used++;
+    neg_epoch++;
+    return 0;
+}
+
+//creates a file (or directory) in our ram filesystem, an empty file takes no blocks at all. tombstoned slots get reused first
+static file_t* node_create(const char* path, const uint8_t* data, uint32_t size, int is_dir) {
+    TRACE(TRACE_FS_CREATE, trace_tag(path), size);
+    char canon[FS_PATH_MAX];
+    if (path_canon(path, canon) < 0) return 0;
+
+    file_t* f = kmem_cache_alloc(file_cache);
+    if (!f) return 0;
+    memset(f, 0, sizeof(file_t));
+    f->is_dir = is_dir;
+    f->pins = 1; //its first write, so an rm that finds it before the data is in waits for it
+    f->writing = 1;
+    if (path_split(canon, f->name) < 0) { kmem_cache_free(file_cache, f); return 0; }
+
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    file_t* dir = resolve(canon);
+    if (!dir || node_attach(dir, f, size) < 0) {
+        spin_unlock_irqrestore(&fs_lock, flags);
+        kfree(f->ext);
+        kmem_cache_free(file_cache, f);
+        return 0;
+    }
+    spin_unlock_irqrestore(&fs_lock, flags);
+
+    copy_in(f, 0, data, size);
+    flags = spin_lock_irqsave(&fs_lock);
+    f->size = size;
+    if (size) f->dirty = 1;
+    spin_unlock_irqrestore(&fs_lock, flags);
+    writer_exit(f);
+    return f;
+}
+
+file_t* fs_create(const char* path, const uint8_t* data, uint32_t size) {
+    return node_create(path, data, size, 0);
+}
+
+file_t* fs_mkdir(const char* path) {
+    return node_create(path, 0, 0, 1);
+}
+
+//the size only moves once the bytes are in, under the lock, so readers and sync never
+//see the tail before it's written
+int fs_append(file_t* f, const uint8_t* data, uint32_t size) {
+    if (!f || !data || writer_enter(f) < 0) return -1;
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    uint32_t at = f->size;
+    uint32_t have = file_blocks(f);
+    uint32_t want = (at + size + FS_BLOCK - 1) / FS_BLOCK;
+    if (want > have && (want - have > blocks_free || file_extend(f, want - have) < 0)) {
+        spin_unlock_irqrestore(&fs_lock, flags);
+        writer_exit(f);
+        return -1;
+    }
+    spin_unlock_irqrestore(&fs_lock, flags);
+
+    copy_in(f, at, data, size);
+    flags = spin_lock_irqsave(&fs_lock);
+    f->size = at + size;
+    f->dirty = 1; //after the copy, a sync that slips in between still sees it next time
+    spin_unlock_irqrestore(&fs_lock, flags);
+    writer_exit(f);
+    return 0;
+}
+
+//replaces what's in an existing file. the old blocks only go back once it's certain the new contents fit
+int fs_write(file_t* f, const uint8_t* data, uint32_t size) {
+    if (!f || !data || writer_enter(f) < 0) return -1;
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    uint32_t want = (size + FS_BLOCK - 1) / FS_BLOCK;
+    //the new extents are built on the side. the old blocks count as free for them, but
+    //nobody else can take them before the lock is dropped, and they go back to the file
+    //if the new ones can't all be had
+    for (uint32_t i = 0; i < f->ext_count; i++) run_mark(f->ext[i].start, f->ext[i].count, 0);
+    file_t fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    if (want > blocks_free || file_extend(&fresh, want) < 0) {
+        file_truncate(&fresh);
+        for (uint32_t i = 0; i < f->ext_count; i++) run_mark(f->ext[i].start, f->ext[i].count, 1);
+        spin_unlock_irqrestore(&fs_lock, flags);
+        kfree(fresh.ext);
+        writer_exit(f);
+        return -1;
+    }
+    struct extent* old = f->ext;
+    extent_total -= f->ext_count;
+    f->ext = fresh.ext;
+    f->ext_count = fresh.ext_count;
+    f->ext_cap = fresh.ext_cap;
+    f->size = 0;
+    spin_unlock_irqrestore(&fs_lock, flags);
+    kfree(old);
+
+    copy_in(f, 0, data, size);
+    flags = spin_lock_irqsave(&fs_lock);
+    f->size = size;
+    f->dirty = 1;
+    spin_unlock_irqrestore(&fs_lock, flags);
+    writer_exit(f);
+    return 0;
+}
+
+uint32_t fs_read(const file_t* f, uint32_t offset, void* buf, uint32_t len) {
+    if (offset >= f->size) return 0;
+    if (len > f->size - offset) len = f->size - offset;
+    uint8_t* dst = buf;
+    uint32_t left = len;
+    for (uint32_t i = 0; i < f->ext_count && left; i++) {
+        uint32_t bytes = f->ext[i].count * FS_BLOCK;
+        if (offset >= bytes) { offset -= bytes; continue; }
+        uint32_t n = bytes - offset < left ? bytes - offset : left;
+        memcpy(dst, block_addr(f->ext[i].start) + offset, n);
+        dst += n;
+        left -= n;
+        offset = 0;
+    }
+    return len;
+}
+
+const uint8_t* fs_extent(const file_t* f, uint32_t i, uint32_t* len) {
+    uint32_t before = 0;
+    if (i >= f->ext_count) return 0;
+    for (uint32_t k = 0; k < i; k++) before += f->ext[k].count * FS_BLOCK;
+    if (before >= f->size) return 0;
+    uint32_t bytes = f->ext[i].count * FS_BLOCK;
+    *len = f->size - before < bytes ? f->size - before : bytes;
+    return block_addr(f->ext[i].start);
+}
+
+int fs_snapshot(fs_handle_t h, struct extent* ext, uint32_t max, uint32_t* count, uint32_t* size) {
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    file_t* f = handle_get(h);
+    if (!f) { spin_unlock_irqrestore(&fs_lock, flags); return -1; }
+    uint32_t n = f->ext_count < max ? f->ext_count : max;
+    memcpy(ext, f->ext, n * sizeof(struct extent));
+    *count = n;
+    *size = f->size;
+    spin_unlock_irqrestore(&fs_lock, flags);
+    return 0;
+}
+
+const uint8_t* fs_block(uint32_t b) {
+    return block_addr(b);
+}
+
+int fs_remove(const char* path) {
+    char canon[FS_PATH_MAX];
+    if (path_canon(path, canon) < 0) return FS_BAD_PATH;
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    file_t* f = resolve(canon);
+    int err = !f ? FS_NOT_FOUND : f == root || f == cwd ? FS_BUSY : f->children ? FS_NOT_EMPTY : 0;
+    if (err) { spin_unlock_irqrestore(&fs_lock, flags); return err; }
+
+    index_find(f->parent, f->name, entry_hash(f->parent, f->name))->f = TOMBSTONE;
+    child_unlink(f);
+    files[f->slot].f = 0;
+    files[f->slot].next_free = free_head;
+    free_head = f->slot;
+    file_count--;
+    dead++;
+    if (dead >= COMPACT_MIN && dead >= compact_at && dead * 2 > table_len) table_compact();
+    if (f->pins) {
+        //a writer is still copying into its blocks, the last one out frees it
+        f->removed = 1;
+        spin_unlock_irqrestore(&fs_lock, flags);
+        return 0;
+    }
+    file_truncate(f);
+    spin_unlock_irqrestore(&fs_lock, flags);
+    kfree(f->ext);
+    kmem_cache_free(file_cache, f);
+    return 0;
+}
+
+//the file keeps its data and its place in the table, it just gets a new index entry and
+//parent. moving a directory moves everything under it, so every cached path goes stale
+int fs_rename(const char* from, const char* to) {
+    char src[FS_PATH_MAX], dst[FS_PATH_MAX], name[MAX_NAME];
+    if (path_canon(from, src) < 0 || path_canon(to, dst) < 0) return FS_BAD_PATH;
+
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    int err = 0;
+    file_t* f = resolve(src);
+    file_t* dir = resolve(dst);
+    if (!f) err = FS_NOT_FOUND;
+    else if (f == root) err = FS_BUSY;
+    else if (dir && dir->is_dir) memcpy(name, f->name, MAX_NAME); //into that directory, same name
+    else if (dir) err = FS_EXISTS;
+    else if (path_split(dst, name) < 0) err = FS_BAD_PATH;
+    else if (!(dir = resolve(dst))) err = FS_NOT_FOUND;
+    else if (!dir->is_dir) err = FS_NOT_DIR;
+
+    uint32_t h = err ? 0 : entry_hash(dir, name);
+    if (!err && index_find(dir, name, h)) err = FS_EXISTS;
+    for (file_t* p = dir; !err && p; p = p->parent) if (p == f) err = FS_BAD_PATH; //into itself
+    if (err) { spin_unlock_irqrestore(&fs_lock, flags); return err; }
+
+    index_find(f->parent, f->name, entry_hash(f->parent, f->name))->f = TOMBSTONE;
+    child_unlink(f);
+    memcpy(f->name, name, MAX_NAME);
+    child_link(dir, f);
+    index_put(name_index, index_cap, h, f);
+    index_used++;
+    if (index_used * 4 > index_cap * 3) index_rehash(); //the old tombstone still counts until then
+    pos_epoch++;
+    neg_epoch++;
+    if (f->is_dir) cwd_refresh();
+    spin_unlock_irqrestore(&fs_lock, flags);
+    return 0;
+}
+
+int fs_chdir(const char* path) {
+    char canon[FS_PATH_MAX];
+    if (path_canon(path, canon) < 0) return FS_BAD_PATH;
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    file_t* f = resolve(canon);
+    int err = !f ? FS_NOT_FOUND : !f->is_dir ? FS_NOT_DIR : 0;
+    if (!err) {
+        cwd = f;
+        memcpy(cwd_path, canon, strlen(canon) + 1);
+    }
+    spin_unlock_irqrestore(&fs_lock, flags);
+    return err;
+}
+
+const char* fs_getcwd(void) {
+    return cwd_path[0] ? cwd_path : "/";
+}
+
+file_t* fs_cwd(void) {
+    return cwd;
+}
+
+uint32_t fs_count(void) {
+    return file_count;
+}
+
+file_t* fs_next(uint32_t* pos) {
+    while (*pos < table_len) {
+        file_t* f = files[(*pos)++].f;
+        if (f && f != root) return f;
+    }
+    return 0;
+}
+
+fs_handle_t fs_handle(const file_t* f) {
+    fs_handle_t h = { f->slot, f->gen };
+    return h;
+}
+
+file_t* fs_get(fs_handle_t h) {
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    file_t* f = handle_get(h);
+    spin_unlock_irqrestore(&fs_lock, flags);
+    return f;
+}
+
+//on the disk: sector 0 is left alone (room for a boot sector), sector 1 is the superblock,
+//then two copies of the metadata (inode table followed by the data bitmap) and the data
+//sectors. a file's data is one contiguous run of sectors. a sync writes changed files to
+//sectors the current metadata doesn't use, then the metadata to the copy that isn't
+//current, and only then flips the superblock over to it, so a sync cut short leaves the
+//previous one whole
+#define DISK_MAGIC    0x5346584C //"LXFS"
+#define DISK_VERSION  2
+#define DISK_SUPER    1
+#define DISK_INODES_MIN 1024     //the inode table is sized at format time, one entry per 32k of
+#define DISK_INODES_MAX 16384    //disk between these, always a whole number of sectors
+#define DISK_DATA_MAX 65536      //sectors, 32MB is plenty next to a 4MB ram region
+#define DISK_DATA_MIN 256
+#define DI_USED 0x01
+#define DI_DIR  0x02
+#define SYNC_CHUNK    0x10000    //bytes staged per disk transfer
+
+struct disk_super {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;            //bumped by every sync
+    uint32_t active;         //which metadata copy is current
+    uint32_t inodes;         //entries used in the inode table
+    uint32_t inode_cap;      //entries it has room for
+    uint32_t meta_start[2];
+    uint32_t inode_sectors;
+    uint32_t bitmap_sectors;
+    uint32_t data_start;
+    uint32_t data_sectors;
+    uint8_t pad[ATA_SECTOR - 12 * 4];
+} __attribute__((packed));
+
+//the root is inode 0. sync numbers the tree depth first, so a parent always comes before its children
+struct disk_inode {
+    char name[MAX_NAME];
+    uint32_t parent;
+    uint32_t size;
+    uint32_t start;          //data sector, relative to data_start
+    uint32_t flags;
+} __attribute__((packed));
+
+//a changed file sync has to write, found by handle since the lock is dropped around the disk
+struct sync_item {
+    fs_handle_t h;
+    uint32_t start;
+    uint32_t size;
+};
+
+#define INODE_SECTORS(cap) ((cap) * sizeof(struct disk_inode) / ATA_SECTOR)
+#define BITMAP_SECTORS (DISK_DATA_MAX / 8 / ATA_SECTOR)
+
+static int disk_ok = 0;           //there's a disk big enough to hold us
+static int disk_formatted = 0;    //and super describes what's on it
+static struct disk_super super;
+static uint32_t* disk_map;        //data sectors the current metadata on disk uses
+static uint32_t* sync_map;        //the ones the metadata being written will use
+static struct disk_inode* inode_buf;
+static struct sync_item* sync_items;
+static uint8_t* sync_buf;
+static uint32_t sync_cursor = 0;  //next fit, a sync's runs end up one after another
+static volatile int syncing = 0;
+static uint32_t disk_used = 0, disk_files = 0;
+
+static inline uint32_t sectors_for(uint32_t bytes) {
+    return (bytes + ATA_SECTOR - 1) / ATA_SECTOR;
+}
+
+static void map_set(uint32_t* map, uint32_t start, uint32_t count) {
+    for (uint32_t b = start; b < start + count; b++) map[b >> 5] |= 1u << (b & 31);
+}
+
+//a run free in both maps, so nothing the disk currently points at gets overwritten
+static int disk_run_find(uint32_t need, uint32_t* start) {
+    uint32_t n = super.data_sectors, run = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t b = sync_cursor + i < n ? sync_cursor + i : sync_cursor + i - n;
+        if (b == 0) run = 0; //runs don't wrap
+        if (((disk_map[b >> 5] | sync_map[b >> 5]) >> (b & 31)) & 1) { run = 0; continue; }
+        if (++run == need) {
+            *start = b + 1 - need;
+            sync_cursor = b + 1 < n ? b + 1 : 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//a superblock whose layout is one we could have formatted and that fits on this disk
+static int super_valid(const struct disk_super* s) {
+    uint32_t cap = s->inode_cap, meta = INODE_SECTORS(cap) + BITMAP_SECTORS;
+    return s->magic == DISK_MAGIC && s->version == DISK_VERSION && s->active <= 1
+        && cap >= DISK_INODES_MIN && cap <= DISK_INODES_MAX && INODE_SECTORS(cap) * ATA_SECTOR == cap * sizeof(struct disk_inode)
+        && s->inode_sectors == INODE_SECTORS(cap) && s->bitmap_sectors == BITMAP_SECTORS
+        && s->meta_start[0] == DISK_SUPER + 1 && s->meta_start[1] == DISK_SUPER + 1 + meta
+        && s->data_start == DISK_SUPER + 1 + 2 * meta
+        && s->data_sectors >= DISK_DATA_MIN && s->data_sectors <= DISK_DATA_MAX
+        && s->data_start + s->data_sectors <= ata_sectors()
+        && s->inodes && s->inodes <= cap;
+}
+
+static int disk_init(void) {
+    //a disk that already has our filesystem keeps the inode table it was formatted with
+    struct disk_super old;
+    uint32_t cap = (ata_sectors() / 64) & ~15u;
+    if (cap < DISK_INODES_MIN) cap = DISK_INODES_MIN;
+    if (cap > DISK_INODES_MAX) cap = DISK_INODES_MAX;
+    if (ata_read(DISK_SUPER, 1, &old) == 0 && super_valid(&old)) cap = old.inode_cap;
+
+    uint32_t meta = INODE_SECTORS(cap) + BITMAP_SECTORS;
+    uint32_t data_start = DISK_SUPER + 1 + 2 * meta;
+    if (ata_sectors() < data_start + DISK_DATA_MIN) return -1;
+
+    disk_map = pages_alloc(DISK_DATA_MAX / 8);
+    sync_map = pages_alloc(DISK_DATA_MAX / 8);
+    inode_buf = pages_alloc(INODE_SECTORS(cap) * ATA_SECTOR);
+    sync_items = pages_alloc(cap * sizeof(struct sync_item));
+    sync_buf = pages_alloc(SYNC_CHUNK);
+    if (!disk_map || !sync_map || !inode_buf || !sync_items || !sync_buf) return -1;
+
+    //what a format would write, also what a loaded superblock has to agree with
+    memset(&super, 0, sizeof(super));
+    super.magic = DISK_MAGIC;
+    super.version = DISK_VERSION;
+    super.active = 1; //so the first sync writes copy 0
+    super.inode_cap = cap;
+    super.meta_start[0] = DISK_SUPER + 1;
+    super.meta_start[1] = DISK_SUPER + 1 + meta;
+    super.inode_sectors = INODE_SECTORS(cap);
+    super.bitmap_sectors = BITMAP_SECTORS;
+    super.data_start = data_start;
+    super.data_sectors = ata_sectors() - data_start;
+    if (super.data_sectors > DISK_DATA_MAX) super.data_sectors = DISK_DATA_MAX;
+    disk_ok = 1;
+    return 0;
+}
+
+//-1 when the disk doesn't hold one of ours, files that don't fit in ram are skipped
+static int disk_load(void) {
+    struct disk_super s;
+    if (ata_read(DISK_SUPER, 1, &s) < 0) return -1;
+    if (!super_valid(&s) || s.inode_cap != super.inode_cap) return -1;
+
+    uint32_t meta = s.meta_start[s.active];
+    file_t** nodes = pages_alloc(s.inodes * sizeof(file_t*));
+    if (!nodes) return -1;
+    if (ata_read(meta, s.inode_sectors, inode_buf) < 0
+        || ata_read(meta + s.inode_sectors, BITMAP_SECTORS, disk_map) < 0) {
+        pages_free(nodes, s.inodes * sizeof(file_t*));
+        memset(disk_map, 0, DISK_DATA_MAX / 8);
+        return -1;
+    }
+    super = s;
+    disk_formatted = 1;
+
+    nodes[0] = root;
+    uint32_t skipped = 0;
+    for (uint32_t i = 1; i < s.inodes; i++) {
+        struct disk_inode* di = &inode_buf[i];
+        file_t* dir = di->parent < i ? nodes[di->parent] : 0;
+        if (!(di->flags & DI_USED) || !dir) { skipped += (di->flags & DI_USED) != 0; continue; }
+        uint32_t size = di->flags & DI_DIR ? 0 : di->size;
+        if (di->start + sectors_for(size) > s.data_sectors) { skipped++; continue; }
+
+        file_t* f = kmem_cache_alloc(file_cache);
+        if (!f) { skipped++; continue; }
+        memset(f, 0, sizeof(file_t));
+        memcpy(f->name, di->name, MAX_NAME);
+        f->name[MAX_NAME - 1] = 0;
+        f->is_dir = (di->flags & DI_DIR) != 0;
+        uint32_t flags = spin_lock_irqsave(&fs_lock);
+        int err = node_attach(dir, f, size);
+        spin_unlock_irqrestore(&fs_lock, flags);
+        if (err < 0) {
+            kfree(f->ext);
+            kmem_cache_free(file_cache, f);
+            skipped++;
+            continue;
+        }
+
+        for (uint32_t off = 0; off < size; off += SYNC_CHUNK) {
+            uint32_t n = size - off < SYNC_CHUNK ? size - off : SYNC_CHUNK;
+            //a sector that won't read leaves zeros, and the file dirty so sync rewrites it
+            if (ata_read(s.data_start + di->start + off / ATA_SECTOR, sectors_for(n), sync_buf) < 0) {
+                memset(sync_buf, 0, n);
+                f->dirty = 1;
+            }
+            copy_in(f, off, sync_buf, n);
+        }
+        f->size = size;
+        f->disk_start = di->start;
+        nodes[i] = f;
+        disk_files++;
+        disk_used += sectors_for(size);
+    }
+    pages_free(nodes, s.inodes * sizeof(file_t*));
+
+    puts("fs: loaded ");
+    print_uint(disk_files);
+    puts(" files from disk");
+    if (skipped) { puts(", "); print_uint(skipped); puts(" skipped"); }
+    puts("\n");
+    return 0;
+}
+
+//anything that may have been half written, next sync puts all of it somewhere fresh
+static void sync_abort(void) {
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    for (uint32_t i = 0; i < table_len; i++)
+        if (files[i].f) files[i].f->dirty = 1;
+    spin_unlock_irqrestore(&fs_lock, flags);
+}
+
+//depth first, next sibling once a subtree is done
+static file_t* tree_next(file_t* n) {
+    if (n->first_child) return n->first_child;
+    while (n && !n->next) n = n->parent;
+    return n ? n->next : 0;
+}
+
+int fs_sync(uint32_t* skipped) {
+    if (!disk_ok) return FS_NO_DISK;
+    if (__atomic_exchange_n(&syncing, 1, __ATOMIC_ACQUIRE)) return FS_BUSY;
+
+    //the tree goes into the inode table under the lock. unchanged files keep their sectors,
+    //changed ones get new ones and are written after the lock is dropped
+    memset(sync_map, 0, DISK_DATA_MAX / 8);
+    memset(inode_buf, 0, super.inode_sectors * ATA_SECTOR);
+    uint32_t count = 0, pending = 0, used = 0;
+    int err = 0;
+    *skipped = 0;
+    uint32_t flags = spin_lock_irqsave(&fs_lock);
+    for (file_t* n = root; n; n = tree_next(n)) {
+        //once the table is full the rest stays in ram only. depth first puts a parent
+        //before its children, so what did fit is a whole tree. a skipped file loses its
+        //sectors, so it's dirty until a sync does write it
+        if (count == super.inode_cap) {
+            if (!n->is_dir && n->size) n->dirty = 1;
+            (*skipped)++;
+            continue;
+        }
+        struct disk_inode* di = &inode_buf[count];
+        n->ino = count++;
+        if (n != root) {
+            memcpy(di->name, n->name, MAX_NAME);
+            di->parent = n->parent->ino;
+        }
+        di->flags = DI_USED | (n->is_dir ? DI_DIR : 0);
+        di->size = n->is_dir ? 0 : n->size;
+        if (!n->is_dir && di->size) {
+            if (n->dirty) {
+                sync_items[pending].h = fs_handle(n);
+                sync_items[pending].size = di->size;
+                pending++;
+            } else {
+                map_set(sync_map, n->disk_start, sectors_for(di->size));
+                di->start = n->disk_start;
+            }
+            used += sectors_for(di->size);
+        }
+    }
+    //only once every unchanged file has its sectors marked
+    for (uint32_t i = 0; i < pending && !err; i++) {
+        file_t* f = handle_get(sync_items[i].h);
+        if (disk_run_find(sectors_for(sync_items[i].size), &sync_items[i].start) < 0) { err = FS_NO_SPACE; break; }
+        map_set(sync_map, sync_items[i].start, sectors_for(sync_items[i].size));
+        inode_buf[f->ino].start = sync_items[i].start;
+        f->disk_start = sync_items[i].start;
+        f->dirty = 0;
+    }
+    spin_unlock_irqrestore(&fs_lock, flags);
+    if (err) goto fail;
+
+    //the data, a chunk at a time through sync_buf. a file removed meanwhile is skipped, the
+    //inode it had is garbage but the next sync won't have it anyway
+    err = FS_IO;
+    for (uint32_t i = 0; i < pending; i++) {
+        struct sync_item* it = &sync_items[i];
+        for (uint32_t off = 0; off < it->size; off += SYNC_CHUNK) {
+            uint32_t n = it->size - off < SYNC_CHUNK ? it->size - off : SYNC_CHUNK;
+            uint32_t sec = sectors_for(n);
+            flags = spin_lock_irqsave(&fs_lock);
+            file_t* f = handle_get(it->h);
+            uint32_t got = f ? fs_read(f, off, sync_buf, n) : 0;
+            spin_unlock_irqrestore(&fs_lock, flags);
+            if (!f) break;
+            memset(sync_buf + got, 0, sec * ATA_SECTOR - got);
+            if (ata_write(super.data_start + it->start + off / ATA_SECTOR, sec, sync_buf) < 0) goto fail;
+        }
+    }
+
+    //the other metadata copy, then the superblock pointing at it
+    struct disk_super s = super;
+    s.active ^= 1;
+    s.seq++;
+    s.inodes = count;
+    if (ata_write(s.meta_start[s.active], s.inode_sectors, inode_buf) < 0
+        || ata_write(s.meta_start[s.active] + s.inode_sectors, BITMAP_SECTORS, sync_map) < 0
+        || ata_flush() < 0
+        || ata_write(DISK_SUPER, 1, &s) < 0
+        || ata_flush() < 0) goto fail;
+
+    super = s;
+    disk_formatted = 1;
+    uint32_t* t = disk_map;
+    disk_map = sync_map;
+    sync_map = t;
+    disk_files = count - 1;
+    disk_used = used;
+    __atomic_store_n(&syncing, 0, __ATOMIC_RELEASE);
+    return pending;
+
+fail:
+    sync_abort();
+    __atomic_store_n(&syncing, 0, __ATOMIC_RELEASE);
+    return err;
+}
+
+void fs_print(void) {
+    puts("files: ");
+    print_uint(file_count);
+    puts(" (");
+    print_uint(dead);
+    puts(" tombstones in ");
+    print_uint(table_len);
+    puts(" slots), ");
+    print_uint((FS_BLOCKS - blocks_free) * FS_BLOCK / 1024);
+    puts(" of ");
+    print_uint(FS_REGION_SIZE / 1024);
+    puts(" KB in ");
+    print_uint(extent_total);
+    puts(" extents, index ");
+    print_uint(index_used);
+    puts("/");
+    print_uint(index_cap);
+    puts("\npath cache: ");
+    print_uint(dc_hits);
+    puts(" hits, ");
+    print_uint(dc_neg_hits);
+    puts(" negative hits, ");
+    print_uint(dc_misses);
+    puts(" misses\n");
+    if (!disk_ok) return;
+    puts("disk: ");
+    if (!disk_formatted) { puts("no filesystem yet, sync makes one\n"); return; }
+    print_uint(disk_files);
+    puts(" files, ");
+    print_uint(disk_used / 2);
+    puts(" of ");
+    print_uint(super.data_sectors / 2);
+    puts(" KB, ");
+    print_uint(super.inodes);
+    puts("/");
+    print_uint(super.inode_cap);
+    puts(" inodes as of sync ");
+    print_uint(super.seq);
+    puts("\n");
+}
+
+void fs_init(void) {
+    file_cache = kmem_cache_create("file", sizeof(file_t), 0, 0);
+    table_resize(TABLE_MIN);
+    index_rehash();
+
+    //the root is in the table so it has a handle, but not in the index, nothing names it
+    root = kmem_cache_alloc(file_cache);
+    memset(root, 0, sizeof(file_t));
+    root->is_dir = 1;
+    slot_take(&root->slot);
+    root->gen = next_gen++;
+    files[root->slot].f = root;
+    cwd = root;
+
+    //a disk that already has our filesystem replaces the default files. a blank one gets
+    //formatted by the first sync
+    if (ata_present() && disk_init() == 0 && disk_load() == 0) return;
+
+    const char *hello = "Welcome to LuxOS!\nType 'help' for commands.\n";
+    fs_create("welcome.txt", (const uint8_t*)hello, (uint32_t)45);
+    const char *readme = "This is a tiny RAM filesystem. Use 'ls' and 'cat'.\n";
+    fs_create("readme.txt", (const uint8_t*)readme, (uint32_t)39);
+}
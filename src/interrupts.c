@@ -1,312 +1,342 @@
-/* kernel_interrupts.c
-   Minimal IDT/IRQ/PIT example for i686 freestanding kernel.
-   - Provides idt_install(), isrs_install(), irq_install()
-   - Timer IRQ updates timer_ticks (volatile)
-   - Simple VGA putchar/puts so you can see output
-*/
-
-#include <stdint.h>
-
-/* ----------------- Basic I/O ----------------- */
-static inline void outb(uint16_t port, uint8_t val) {
-    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
-}
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
-
-void vga_puts(const char *str);
-void print_uint(uint32_t num);
-
-struct regs {
-    uint32_t gs, fs, es, ds;
-    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
-    uint32_t int_no, err_code;
-    uint32_t eip, cs, eflags, useresp, ss;
-};
-
-void isr_handler(struct regs *r) {
-    vga_puts("ISR: ");
-    print_uint(r->int_no);
-    vga_puts("\n");
-}
-
-void irq_handler(struct regs *r) {
-    if (r->int_no >= 40) outb(0xA0, 0x20); // slave PIC
-    outb(0x20, 0x20);                      // master PIC
-    // Optional: custom handlers
-}
-
-__attribute__((naked)) void isr_common_stub() {
-    __asm__ __volatile__(
-        "pusha\n"
-        "push %ds\n"
-        "push %es\n"
-        "push %fs\n"
-        "push %gs\n"
-        "mov $0x10, %ax\n"
-        "mov %ax, %ds\n"
-        "mov %ax, %es\n"
-        "mov %ax, %fs\n"
-        "mov %ax, %gs\n"
-        "push %esp\n"
-        "call isr_handler\n"
-        "add $4, %esp\n"
-        "pop %gs\n"
-        "pop %fs\n"
-        "pop %es\n"
-        "pop %ds\n"
-        "popa\n"
-        "add $8, %esp\n"
-        "sti\n"
-        "iret\n"
-    );
-}
-
-__attribute__((naked)) void irq_common_stub() {
-    __asm__ __volatile__(
-        "pusha\n"
-        "push %ds\n"
-        "push %es\n"
-        "push %fs\n"
-        "push %gs\n"
-        "mov $0x10, %ax\n"
-        "mov %ax, %ds\n"
-        "mov %ax, %es\n"
-        "mov %ax, %fs\n"
-        "mov %ax, %gs\n"
-        "push %esp\n"
-        "call irq_handler\n"
-        "add $4, %esp\n"
-        "pop %gs\n"
-        "pop %fs\n"
-        "pop %es\n"
-        "pop %ds\n"
-        "popa\n"
-        "add $8, %esp\n"
-        "sti\n"
-        "iret\n"
-    );
-}
-
-
-/* ----------------- VGA (tiny) ----------------- */
-volatile uint16_t* VGA = (uint16_t*)0xB8000;
-static uint16_t vga_row = 0, vga_col = 0;
-static uint8_t vga_color = (0 << 4) | 7;
-
-static void vga_putc(char ch) {
-    if (ch == '\n') {
-        vga_row++; vga_col = 0;
-        if (vga_row >= 25) vga_row = 24;
-        return;
-    }
-    VGA[vga_row*80 + vga_col] = (uint16_t)ch | ((uint16_t)vga_color << 8);
-    vga_col++;
-    if (vga_col >= 80) { vga_col = 0; vga_row++; if (vga_row >= 25) vga_row = 24; }
-}
-void vga_puts(const char* s) { while (*s) vga_putc(*s++); }
-
-void print_uint(uint32_t num) {
-    char buf[11];
-    int i = 10;
-    buf[i] = '\0';
-    if (num == 0) { vga_putc('0'); return; }
-    while (num > 0 && i > 0) {
-        buf[--i] = '0' + (num % 10);
-        num /= 10;
-    }
-    vga_puts(&buf[i]);
-}
-
-/* ----------------- IDT data ----------------- */
-struct idt_entry {
-    uint16_t base_lo;
-    uint16_t sel;
-    uint8_t  always0;
-    uint8_t  flags;
-    uint16_t base_hi;
-} __attribute__((packed));
-
-struct idt_ptr {
-    uint16_t limit;
-    uint32_t base;
-} __attribute__((packed));
-
-#define IDT_ENTRIES 256
-static struct idt_entry idt[IDT_ENTRIES];
-static struct idt_ptr   idtp;
-
-/* External assembly symbols (defined in interrupts.asm) */
-extern void idt_load(void);
-extern void isr0(void);  extern void isr1(void);  extern void isr2(void);  extern void isr3(void);
-extern void isr4(void);  extern void isr5(void);  extern void isr6(void);  extern void isr7(void);
-extern void isr8(void);  extern void isr9(void);  extern void isr10(void); extern void isr11(void);
-extern void isr12(void); extern void isr13(void); extern void isr14(void); extern void isr15(void);
-extern void isr16(void); extern void isr17(void); extern void isr18(void); extern void isr19(void);
-extern void isr20(void); extern void isr21(void); extern void isr22(void); extern void isr23(void);
-extern void isr24(void); extern void isr25(void); extern void isr26(void); extern void isr27(void);
-extern void isr28(void); extern void isr29(void); extern void isr30(void); extern void isr31(void);
-
-extern void irq0(void);  extern void irq1(void);  extern void irq2(void);  extern void irq3(void);
-extern void irq4(void);  extern void irq5(void);  extern void irq6(void);  extern void irq7(void);
-extern void irq8(void);  extern void irq9(void);  extern void irq10(void); extern void irq11(void);
-extern void irq12(void); extern void irq13(void); extern void irq14(void); extern void irq15(void);
-
-/* ----------------- IDT helpers ----------------- */
-static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags) {
-    idt[num].base_lo = base & 0xFFFF;
-    idt[num].base_hi = (base >> 16) & 0xFFFF;
-    idt[num].sel     = sel;
-    idt[num].always0 = 0;
-    idt[num].flags   = flags;
-}
-
-//this one
-void idt_install(void) {
-    idtp.limit = (sizeof(struct idt_entry) * IDT_ENTRIES) - 1;
-    idtp.base  = (uint32_t)&idt;
-    for (int i = 0; i < IDT_ENTRIES; i++) {
-        idt[i].base_lo = 0;
-        idt[i].sel = 0;
-        idt[i].always0 = 0;
-        idt[i].flags = 0;
-        idt[i].base_hi = 0;
-    }
-    idt_load();
-}
-
-//this one
-void isrs_install(void) {
-    /* set CPU exception handlers 0..31 */
-    idt_set_gate(0,  (uint32_t)isr0,  0x08, 0x8E);
-    idt_set_gate(1,  (uint32_t)isr1,  0x08, 0x8E);
-    idt_set_gate(2,  (uint32_t)isr2,  0x08, 0x8E);
-    idt_set_gate(3,  (uint32_t)isr3,  0x08, 0x8E);
-    idt_set_gate(4,  (uint32_t)isr4,  0x08, 0x8E);
-    idt_set_gate(5,  (uint32_t)isr5,  0x08, 0x8E);
-    idt_set_gate(6,  (uint32_t)isr6,  0x08, 0x8E);
-    idt_set_gate(7,  (uint32_t)isr7,  0x08, 0x8E);
-    idt_set_gate(8,  (uint32_t)isr8,  0x08, 0x8E);
-    idt_set_gate(9,  (uint32_t)isr9,  0x08, 0x8E);
-    idt_set_gate(10, (uint32_t)isr10, 0x08, 0x8E);
-    idt_set_gate(11, (uint32_t)isr11, 0x08, 0x8E);
-    idt_set_gate(12, (uint32_t)isr12, 0x08, 0x8E);
-    idt_set_gate(13, (uint32_t)isr13, 0x08, 0x8E);
-    idt_set_gate(14, (uint32_t)isr14, 0x08, 0x8E);
-    idt_set_gate(15, (uint32_t)isr15, 0x08, 0x8E);
-    idt_set_gate(16, (uint32_t)isr16, 0x08, 0x8E);
-    idt_set_gate(17, (uint32_t)isr17, 0x08, 0x8E);
-    idt_set_gate(18, (uint32_t)isr18, 0x08, 0x8E);
-    idt_set_gate(19, (uint32_t)isr19, 0x08, 0x8E);
-    idt_set_gate(20, (uint32_t)isr20, 0x08, 0x8E);
-    idt_set_gate(21, (uint32_t)isr21, 0x08, 0x8E);
-    idt_set_gate(22, (uint32_t)isr22, 0x08, 0x8E);
-    idt_set_gate(23, (uint32_t)isr23, 0x08, 0x8E);
-    idt_set_gate(24, (uint32_t)isr24, 0x08, 0x8E);
-    idt_set_gate(25, (uint32_t)isr25, 0x08, 0x8E);
-    idt_set_gate(26, (uint32_t)isr26, 0x08, 0x8E);
-    idt_set_gate(27, (uint32_t)isr27, 0x08, 0x8E);
-    idt_set_gate(28, (uint32_t)isr28, 0x08, 0x8E);
-    idt_set_gate(29, (uint32_t)isr29, 0x08, 0x8E);
-    idt_set_gate(30, (uint32_t)isr30, 0x08, 0x8E);
-    idt_set_gate(31, (uint32_t)isr31, 0x08, 0x8E);
-}
-
-#define PIC1    0x20
-#define PIC2    0xA0
-#define PIC1_CMD PIC1
-#define PIC1_DATA (PIC1+1)
-#define PIC2_CMD PIC2
-#define PIC2_DATA (PIC2+1)
-#define ICW1_INIT  0x11
-#define ICW4_8086  0x01
-
-void irq_remap(void) {
-    outb(PIC1_CMD, ICW1_INIT);
-    outb(PIC2_CMD, ICW1_INIT);
-    outb(PIC1_DATA, 0x20); // offset for master PIC (0x20 = 32)
-    outb(PIC2_DATA, 0x28); // offset for slave PIC (0x28 = 40)
-    outb(PIC1_DATA, 4);
-    outb(PIC2_DATA, 2);
-    outb(PIC1_DATA, ICW4_8086);
-    outb(PIC2_DATA, ICW4_8086);
-    // mask none
-    outb(PIC1_DATA, 0x0);
-    outb(PIC2_DATA, 0x0);
-}
-
-void irq_install(void) {
-    irq_remap();
-    /* IRQs map to IDT entries 32..47 */
-    idt_set_gate(32, (uint32_t)irq0, 0x08, 0x8E);
-    idt_set_gate(33, (uint32_t)irq1, 0x08, 0x8E);
-    idt_set_gate(34, (uint32_t)irq2, 0x08, 0x8E);
-    idt_set_gate(35, (uint32_t)irq3, 0x08, 0x8E);
-    idt_set_gate(36, (uint32_t)irq4, 0x08, 0x8E);
-    idt_set_gate(37, (uint32_t)irq5, 0x08, 0x8E);
-    idt_set_gate(38, (uint32_t)irq6, 0x08, 0x8E);
-    idt_set_gate(39, (uint32_t)irq7, 0x08, 0x8E);
-    idt_set_gate(40, (uint32_t)irq8, 0x08, 0x8E);
-    idt_set_gate(41, (uint32_t)irq9, 0x08, 0x8E);
-    idt_set_gate(42, (uint32_t)irq10,0x08, 0x8E);
-    idt_set_gate(43, (uint32_t)irq11,0x08, 0x8E);
-    idt_set_gate(44, (uint32_t)irq12,0x08, 0x8E);
-    idt_set_gate(45, (uint32_t)irq13,0x08, 0x8E);
-    idt_set_gate(46, (uint32_t)irq14,0x08, 0x8E);
-    idt_set_gate(47, (uint32_t)irq15,0x08, 0x8E);
-}
-
-/* ----------------- Timer tick ----------------- */
-volatile uint32_t timer_ticks = 0;
-
-void timer_callback(void) {
-    timer_ticks++;
-}
-
-/* ----------------- C-level IRQ/ISR handlers ----------------- */
-/* regs struct layout must match assembly push order */
-struct regs {
-    uint32_t gs, fs, es, ds;
-    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
-    uint32_t int_no;
-    uint32_t err_code;
-    uint32_t eip, cs, eflags, useresp, ss;
-};
-
-
-/* ----------------- PIT init (polling-less; uses IRQ0) ----------------- */
-void init_pit(uint32_t frequency) {
-    uint32_t divisor = 1193180 / frequency;
-    outb(0x43, 0x36); // channel0, lobyte/hibyte, mode 3
-    outb(0x40, (uint8_t)(divisor & 0xFF));
-    outb(0x40, (uint8_t)((divisor >> 8) & 0xFF));
-}
-
-/* ----------------- Kernel entry for testing ----------------- */
-/* Call these from your existing kernel_main to integrate */
-void kernel_main(void) {
-    idt_install();
-    isrs_install();
-    irq_install();
-    init_pit(100);        // 100 Hz tick (10 ms)
-    __asm__ volatile("sti"); // enable interrupts
-
-    vga_puts("Interrupts installed. Waiting for ticks...\n");
-
-    uint32_t last = 0;
-    while (1) {
-        if (timer_ticks != last) {
-            last = timer_ticks;
-            if (last % 100 == 0) { // every ~1 second at 100Hz
-                vga_puts("ticks: ");
-                print_uint(last);
-                vga_puts("\n");
-            }
-        }
-    }
-}
-
-
+/* interrupts.c
+   IDT/IRQ/PIT setup for the i686 kernel.
+   - Provides idt_install(), isrs_install(), irq_install()
+   - Entry stubs for all 256 vectors are generated in isr.S
+   - Drivers hook vectors with irq_register()/interrupt_register(), and
+     interrupt_dispatch() does one table lookup per interrupt
+*/
+
+#include "../include/common.h"
+#include "../include/console.h"
+#include "../include/interrupts.h"
+#include "../include/ksyms.h"
+#include "../include/trace.h"
+#include "../include/clock.h"
+#include "../include/apic.h"
+#include "../include/smp.h"
+#include "../include/thread.h"
+#include "../include/workq.h"
+#include "../include/paging.h"
+
+/* ----------------- Basic I/O ----------------- */
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+/* ----------------- IDT data ----------------- */
+struct idt_entry {
+    uint16_t base_lo;
+    uint16_t sel;
+    uint8_t  always0;
+    uint8_t  flags;
+    uint16_t base_hi;
+} __attribute__((packed));
+
+struct idt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+#define IDT_ENTRIES 256
+static struct idt_entry idt[IDT_ENTRIES];
+static struct idt_ptr   idtp;
+
+/* External assembly symbols (defined in isr.S) */
+extern void idt_load(struct idt_ptr* p);
+extern const uint32_t interrupt_stubs[IDT_ENTRIES];
+
+/* one slot per vector, dispatch is a single indexed call */
+struct irq_slot {
+    irq_fn fn;
+    void*  ctx;
+};
+static struct irq_slot handlers[IDT_ENTRIES];
+
+/* per vector statistics for irqstat, cycles are measured around the whole dispatch.
+   each cpu keeps its own so the counters never race, irqstat adds them up */
+struct irq_stat {
+    uint32_t count;
+    uint32_t cycles_max;
+    uint64_t cycles_total;
+    uint32_t lat_count;   //only sources that know their deadline report latency
+    uint32_t lat_max_ns;
+    uint64_t lat_total_ns;
+};
+static struct irq_stat irq_stats[MAX_CPUS][IDT_ENTRIES];
+
+/* ----------------- IDT helpers ----------------- */
+static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags) {
+    idt[num].base_lo = base & 0xFFFF;
+    idt[num].base_hi = (base >> 16) & 0xFFFF;
+    idt[num].sel     = sel;
+    idt[num].always0 = 0;
+    idt[num].flags   = flags;
+}
+
+//this one
+void idt_install(void) {
+    idtp.limit = (sizeof(struct idt_entry) * IDT_ENTRIES) - 1;
+    idtp.base  = (uint32_t)&idt;
+    for (int i = 0; i < IDT_ENTRIES; i++) {
+        idt_set_gate(i, interrupt_stubs[i], 0x08, 0x8E);
+        handlers[i].fn = 0;
+        handlers[i].ctx = 0;
+    }
+    idt_load(&idtp);
+}
+
+/* ----------------- CPU exceptions ----------------- */
+static const char* exception_names[32] = {
+    "divide error", "debug", "nmi", "breakpoint", "overflow", "bound range",
+    "invalid opcode", "device not available", "double fault", "coprocessor overrun",
+    "invalid tss", "segment not present", "stack fault", "general protection",
+    "page fault", "reserved", "x87 fp error", "alignment check", "machine check",
+    "simd fp error", "virtualization", "control protection", "reserved", "reserved",
+    "reserved", "reserved", "reserved", "reserved", "hypervisor injection",
+    "vmm communication", "security", "reserved"
+};
+
+//nothing to recover to, print what happened and stop this cpu
+static void exception_default(struct regs *r, void* ctx) {
+    (void)ctx;
+    puts("\nEXCEPTION ");
+    print_uint(r->int_no);
+    puts(": ");
+    puts(exception_names[r->int_no & 31]);
+    puts("\n  eip ");
+    print_hex(r->eip);
+    int sym = ksym_lookup(r->eip);
+    if (sym >= 0) { puts(" ("); puts(ksyms[sym].name); puts(")"); }
+    puts("  err ");
+    print_hex(r->err_code);
+    puts("\nsystem halted\n");
+    while (1) __asm__ volatile ("cli; hlt");
+}
+
+//on its own stack in its own task, so this works even when the kernel stack is what broke.
+//cr2 is still whatever the fault that couldn't be delivered was about
+void double_fault_task(void) {
+    uint32_t addr;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(addr));
+    puts("\nEXCEPTION 8: double fault\n  cr2 ");
+    print_hex(addr);
+    const char* g = paging_guard_name(addr);
+    if (g) { puts(", guard page under the "); puts(g); puts(", stack overflow"); }
+    puts("\nsystem halted\n");
+    while (1) __asm__ volatile ("cli; hlt");
+}
+
+//other cpus share the one idt, they just need to point their idtr at it
+void idt_reload(void) {
+    idt_load(&idtp);
+}
+
+//this one
+void isrs_install(void) {
+    /* set CPU exception handlers 0..31, anything can replace them with interrupt_register */
+    for (int i = 0; i < 32; i++) interrupt_register(i, exception_default, 0);
+    //a double fault is a task gate (0x85) instead, the stub would need the stack that just failed
+    idt_set_gate(8, 0, smp_double_fault_tss(), 0x85);
+}
+
+int interrupt_register(uint8_t vector, irq_fn fn, void* ctx) {
+    if (handlers[vector].fn && handlers[vector].fn != exception_default) return -1;
+    uint32_t flags = irq_save();
+    handlers[vector].ctx = ctx;
+    handlers[vector].fn = fn;
+    irq_restore(flags);
+    return 0;
+}
+
+void interrupt_unregister(uint8_t vector) {
+    uint32_t flags = irq_save();
+    handlers[vector].fn = 0;
+    handlers[vector].ctx = 0;
+    irq_restore(flags);
+}
+
+#define PIC1    0x20
+#define PIC2    0xA0
+#define PIC1_CMD PIC1
+#define PIC1_DATA (PIC1+1)
+#define PIC2_CMD PIC2
+#define PIC2_DATA (PIC2+1)
+#define ICW1_INIT  0x11
+#define ICW4_8086  0x01
+#define PIC_EOI    0x20
+#define PIC_READ_ISR 0x0B
+
+static int use_apic = 0; //irqs come through the ioapic and get their eoi from the local apic
+
+void irq_remap(void) {
+    outb(PIC1_CMD, ICW1_INIT);
+    outb(PIC2_CMD, ICW1_INIT);
+    outb(PIC1_DATA, 0x20); // offset for master PIC (0x20 = 32)
+    outb(PIC2_DATA, 0x28); // offset for slave PIC (0x28 = 40)
+    outb(PIC1_DATA, 4);
+    outb(PIC2_DATA, 2);
+    outb(PIC1_DATA, ICW4_8086);
+    outb(PIC2_DATA, ICW4_8086);
+    // mask everything but the cascade line, drivers unmask what they handle
+    outb(PIC1_DATA, 0xFB);
+    outb(PIC2_DATA, 0xFF);
+}
+
+void irq_unmask(uint8_t irq) {
+    if (use_apic) { ioapic_unmask(irq); return; }
+    if (irq < 8) outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+    else outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+}
+
+void irq_mask(uint8_t irq) {
+    if (use_apic) { ioapic_mask(irq); return; }
+    if (irq < 8) outb(PIC1_DATA, inb(PIC1_DATA) | (1 << irq));
+    else outb(PIC2_DATA, inb(PIC2_DATA) | (1 << (irq - 8)));
+}
+
+void irq_install(void) {
+    irq_remap();
+    /* IRQs map to IDT entries 32..47, the gates are already there from idt_install.
+       with an ioapic they keep the same vectors, the 8259s just get masked */
+    use_apic = apic_init();
+}
+
+//hooks a legacy irq line (0-15) and unmasks it
+int irq_register(uint8_t irq, irq_fn fn, void* ctx) {
+    if (irq >= 16) return -1;
+    if (interrupt_register(IRQ_BASE + irq, fn, ctx) != 0) return -1;
+    irq_unmask(irq);
+    return 0;
+}
+
+void irq_unregister(uint8_t irq) {
+    if (irq >= 16) return;
+    irq_mask(irq);
+    interrupt_unregister(IRQ_BASE + irq);
+}
+
+//irq 7 and 15 also show up when a line drops before the pic delivers it, the in-service bit tells them apart
+static int pic_spurious(uint32_t irq) {
+    if (irq == 7) {
+        outb(PIC1_CMD, PIC_READ_ISR);
+        return !(inb(PIC1_CMD) & 0x80);
+    }
+    if (irq == 15) {
+        outb(PIC2_CMD, PIC_READ_ISR);
+        if (inb(PIC2_CMD) & 0x80) return 0;
+        outb(PIC1_CMD, PIC_EOI); //the master did see the cascade line
+        return 1;
+    }
+    return 0;
+}
+
+/* ----------------- C-level dispatch ----------------- */
+void interrupt_dispatch(struct regs *r) {
+    uint64_t start = rdtsc();
+    uint32_t vector = r->int_no;
+    TRACE(TRACE_IRQ, vector, r->eip);
+
+    if (use_apic) {
+        if (vector >= IRQ_BASE && vector != APIC_SPURIOUS_VECTOR) apic_eoi();
+    } else if (vector - IRQ_BASE < 16) {
+        uint32_t irq = vector - IRQ_BASE;
+        if ((irq == 7 || irq == 15) && pic_spurious(irq)) return;
+        if (irq >= 8) outb(PIC2_CMD, PIC_EOI); // slave PIC
+        outb(PIC1_CMD, PIC_EOI);               // master PIC
+    }
+
+    struct irq_slot* h = &handlers[vector];
+    if (h->fn) h->fn(r, h->ctx);
+
+    struct cpu* c = this_cpu();
+    struct irq_stat* st = &irq_stats[c->index][vector];
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    st->count++;
+    st->cycles_total += cycles;
+    c->irqs++;
+    if (cycles > st->cycles_max) st->cycles_max = cycles;
+
+    //bottom halves, with interrupts back on. an irq that lands while a drain further up
+    //this stack is running leaves its work to that drain
+    if (!c->in_drain) work_drain();
+
+    //the slice ran out or a wakeup wants the cpu. not from inside a drain, that has to
+    //finish on this stack first. interrupts are still off here
+    if (threads_running() && c->current && c->need_resched && !c->in_drain) schedule();
+}
+
+//a handler that knows when its interrupt was due (the timer deadline) reports how late it got there
+void interrupt_record_latency(uint8_t vector, uint64_t late_ns) {
+    struct irq_stat* st = &irq_stats[this_cpu()->index][vector];
+    uint32_t ns = late_ns > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)late_ns;
+    st->lat_count++;
+    st->lat_total_ns += ns;
+    if (ns > st->lat_max_ns) st->lat_max_ns = ns;
+}
+
+void interrupt_reset_stats(void) {
+    uint32_t flags = irq_save();
+    for (int c = 0; c < MAX_CPUS; c++) {
+        for (int i = 0; i < IDT_ENTRIES; i++) {
+            struct irq_stat* st = &irq_stats[c][i];
+            st->count = st->cycles_max = st->lat_count = st->lat_max_ns = 0;
+            st->cycles_total = st->lat_total_ns = 0;
+        }
+    }
+    irq_restore(flags);
+}
+
+//all cpus' counters for one vector added up, maxes are the max over cpus
+static struct irq_stat sum_stats(int v) {
+    struct irq_stat sum = { 0 };
+    for (int c = 0; c < MAX_CPUS; c++) {
+        struct irq_stat* st = &irq_stats[c][v];
+        sum.count += st->count;
+        sum.cycles_total += st->cycles_total;
+        if (st->cycles_max > sum.cycles_max) sum.cycles_max = st->cycles_max;
+        sum.lat_count += st->lat_count;
+        sum.lat_total_ns += st->lat_total_ns;
+        if (st->lat_max_ns > sum.lat_max_ns) sum.lat_max_ns = st->lat_max_ns;
+    }
+    return sum;
+}
+
+//irqstat: one line per vector that has fired, named after its handler
+void interrupt_print_stats(void) {
+    workq_print_stats();
+    puts("vec      count   avg cyc   max cyc  late avg/max us  handler\n");
+    for (int v = 0; v < IDT_ENTRIES; v++) {
+        struct irq_stat st = sum_stats(v);
+        if (st.count == 0) continue;
+
+        print_padded(v, 3);
+        print_padded(st.count, 11);
+        print_padded((uint32_t)div64_u32(st.cycles_total, st.count, 0), 10);
+        print_padded(st.cycles_max, 10);
+        if (st.lat_count) {
+            print_padded((uint32_t)div64_u32(div64_u32(st.lat_total_ns, st.lat_count, 0), 1000, 0), 9);
+            putchar('/');
+            print_uint(st.lat_max_ns / 1000);
+            puts("  ");
+        } else {
+            puts("        -        ");
+        }
+        int sym = handlers[v].fn ? ksym_lookup((uint32_t)handlers[v].fn) : -1;
+        puts(sym >= 0 ? ksyms[sym].name : "-");
+        puts("\n");
+    }
+}
+
+
+/* ----------------- PIT init (polling-less; uses IRQ0) ----------------- */
+void init_pit(uint32_t frequency) {
+    uint32_t divisor = 1193180 / frequency;
+    outb(0x43, 0x36); // channel0, lobyte/hibyte, mode 3
+    outb(0x40, (uint8_t)(divisor & 0xFF));
+    outb(0x40, (uint8_t)((divisor >> 8) & 0xFF));
+}
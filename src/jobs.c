@@ -0,0 +1,155 @@
+#include "../include/common.h"
+#include "../include/jobs.h"
+#include "../include/smp.h"
+#include "../include/apic.h"
+#include "../include/interrupts.h"
+
+//chase-lev deques ("dynamic circular work-stealing deque", 2005) with a fixed size ring.
+//only the owning cpu touches bottom, thieves race each other (and the owner, for the
+//last job) on top with a cmpxchg. on x86 the only fence needed is the one in pop:
+//the store to bottom has to be visible before we read top
+#define DEQUE_SIZE 256
+#define DEQUE_MASK (DEQUE_SIZE - 1)
+
+struct deque {
+    volatile int32_t top;
+    volatile int32_t bottom;
+    struct job* volatile ring[DEQUE_SIZE];
+} __attribute__((aligned(64))); //top/bottom of different cpus on different cache lines
+
+static struct deque deques[MAX_CPUS];
+static volatile uint32_t jobs_queued = 0; //pushed but not yet taken, lets idle cpus skip a pointless scan
+static volatile uint32_t idle_mask = 0;   //cpus sleeping in jobs_worker_loop
+
+static int deque_push(struct deque* d, struct job* j) {
+    int32_t b = d->bottom;
+    int32_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= DEQUE_SIZE) return -1;
+    d->ring[b & DEQUE_MASK] = j;
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static struct job* deque_pop(struct deque* d) {
+    int32_t b = d->bottom - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t t = d->top;
+
+    if (t > b) { //empty
+        d->bottom = b + 1;
+        return 0;
+    }
+    struct job* j = d->ring[b & DEQUE_MASK];
+    if (t == b) {
+        //last one, a thief may be going for it too
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            j = 0;
+        d->bottom = b + 1;
+    }
+    return j;
+}
+
+static struct job* deque_steal(struct deque* d) {
+    int32_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return 0;
+
+    struct job* j = d->ring[t & DEQUE_MASK];
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return 0; //lost the race, the caller just tries again
+    return j;
+}
+
+static void run_job(struct cpu* c, struct job* j) {
+    __atomic_fetch_sub(&jobs_queued, 1, __ATOMIC_SEQ_CST);
+    c->jobs_run++;
+    j->fn(j->arg);
+    __atomic_store_n(&j->done, 1, __ATOMIC_RELEASE);
+}
+
+//our own deque first (newest job, still warm in cache), then everyone else starting after us
+static struct job* find_job(struct cpu* c) {
+    struct job* j = deque_pop(&deques[c->index]);
+    if (j) return j;
+
+    for (uint32_t n = 1; n < cpu_count; n++) {
+        uint32_t victim = (c->index + n) % cpu_count;
+        if (!cpus[victim].online) continue;
+        j = deque_steal(&deques[victim]);
+        if (j) { c->steals++; return j; }
+    }
+    return 0;
+}
+
+//an idle cpu, if there is one, goes looking for work. clearing its bit claims it, so
+//a burst of spawns wakes a different cpu each time instead of poking the same one
+static void wake_idle_cpu(void) {
+    uint32_t mask = __atomic_load_n(&idle_mask, __ATOMIC_SEQ_CST);
+    while (mask) {
+        uint32_t bit = mask & -mask;
+        if (__atomic_fetch_and(&idle_mask, ~bit, __ATOMIC_SEQ_CST) & bit) {
+            apic_send_ipi(cpus[__builtin_ctz(bit)].apic_id, ICR_FIXED | ICR_ASSERT | JOB_WAKE_VECTOR);
+            return;
+        }
+        mask = __atomic_load_n(&idle_mask, __ATOMIC_SEQ_CST);
+    }
+}
+
+void spawn(struct job* j, void (*fn)(void*), void* arg) {
+    struct cpu* c = this_cpu();
+    j->fn = fn;
+    j->arg = arg;
+    j->done = 0;
+
+    __atomic_fetch_add(&jobs_queued, 1, __ATOMIC_SEQ_CST);
+    uint32_t flags = irq_save(); //the deque belongs to this cpu, don't let an irq handler in halfway
+    int full = deque_push(&deques[c->index], j);
+    irq_restore(flags);
+    if (full) { //no room, just do it now
+        run_job(c, j);
+        return;
+    }
+    wake_idle_cpu();
+}
+
+void join(struct job* j) {
+    while (!__atomic_load_n(&j->done, __ATOMIC_ACQUIRE)) {
+        struct cpu* c = this_cpu();
+        uint32_t flags = irq_save();
+        struct job* other = find_job(c);
+        irq_restore(flags);
+        if (other) run_job(c, other);
+        else __asm__ volatile ("pause");
+    }
+}
+
+static void job_wake_irq(struct regs* r, void* ctx) {
+    (void)r; (void)ctx; //the eoi is all it takes, the cpu is already out of hlt
+}
+
+void jobs_init(void) {
+    interrupt_register(JOB_WAKE_VECTOR, job_wake_irq, 0);
+}
+
+void jobs_worker_loop(void) {
+    struct cpu* c = this_cpu();
+    uint32_t bit = 1u << c->index;
+    while (1) {
+        __asm__ volatile ("cli");
+        struct job* j = find_job(c);
+        if (j) {
+            __asm__ volatile ("sti");
+            run_job(c, j);
+            continue;
+        }
+
+        //say we're idle before the last look, spawn() bumps jobs_queued before it reads idle_mask
+        //so one of us is guaranteed to see the other
+        __atomic_fetch_or(&idle_mask, bit, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&jobs_queued, __ATOMIC_SEQ_CST) == 0) cpu_idle();
+        else __asm__ volatile ("sti");
+        __atomic_fetch_and(&idle_mask, ~bit, __ATOMIC_SEQ_CST);
+    }
+}
@@ -1,6 +1,24 @@
 #include "../include/common.h"
 #include "../include/string.h"
 #include "../include/cli.h"
+#include "../include/clock.h"
+#include "../include/interrupts.h"
+#include "../include/timer.h"
+#include "../include/profile.h"
+#include "../include/serial.h"
+#include "../include/trace.h"
+#include "../include/console.h"
+#include "../include/keyboard.h"
+#include "../include/smp.h"
+#include "../include/jobs.h"
+#include "../include/thread.h"
+#include "../include/workq.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/paging.h"
+#include "../include/arena.h"
+#include "../include/fs.h"
+#include "../include/ata.h"
 
 //declaration of a few important variables
 volatile uint16_t* VGA = (uint16_t*)0xB8000;
@@ -8,11 +26,6 @@ uint16_t cursor_row = 0, cursor_col = 0;
 static uint8_t color = (0 << 4) | 5;
 uint32_t uptime_start = 0;
 
-//headers for timer functions, can be ignored
-void hpet_init(void);
-double uptime_seconds(void);
-
-
 //functions that use assembly code, this is how we put things in registers
 static inline void outb(uint16_t port, uint8_t val) {
     __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
@@ -23,87 +36,26 @@ static inline uint8_t inb(uint16_t port) {
     return ret;
 }
 
-//our timer system
-#define HPET_BASE          0xFED00000 
-#define HPET_CAP_LOW       (*(volatile uint32_t*)(HPET_BASE + 0x00)) 
-#define HPET_CAP_HIGH      (*(volatile uint32_t*)(HPET_BASE + 0x04)) 
-#define HPET_CONFIG_LOW    (*(volatile uint32_t*)(HPET_BASE + 0x10)) 
-#define HPET_COUNTER_LOW   (*(volatile uint32_t*)(HPET_BASE + 0xF0)) //counter register
-#define HPET_COUNTER_HIGH  (*(volatile uint32_t*)(HPET_BASE + 0xF4)) //second counter register, only is used if first overflows
-
-//timer variables
-static double hpet_tick_seconds = 0.0;
-static double hpet_tick_microseconds = 0.0;
-static uint32_t last_high = 0;
-static uint32_t overflow_count = 0;
-
-//initialize the timer, creates our two conversion factors
-void hpet_init(void) {
-    HPET_CONFIG_LOW |= 1;
-
-    uint32_t period_fs = HPET_CAP_HIGH;
-
-    hpet_tick_seconds = (double)period_fs / 1e15;
-    
-    hpet_tick_microseconds = (double)period_fs / 1e9;
-
-    last_high = HPET_COUNTER_HIGH;
-    overflow_count = 0;
-}
-
-//if the high register overflows, we track it allowing us to have larger times
-void hpet_poll_overflow(void) {
-    uint32_t high = HPET_COUNTER_HIGH;
-
-    // If the high part increased, a wrap occurred
-    if (high < last_high) {
-        overflow_count++;
-    }
-
-    last_high = high;
-}
-
-uint32_t hpet_get_low(void) {
-    return HPET_COUNTER_LOW;
-}
-
-//converts the registers values into seconds used for our uptime function
-double uptime_seconds(void) {
-    hpet_poll_overflow();
-
-    uint32_t low = hpet_get_low();
-    uint32_t high = last_high + overflow_count * 0xFFFFFFFF;
-
-    double total_ticks = (double)high * 4294967296.0 + (double)low;
-    return total_ticks * hpet_tick_seconds;
+//our timer system lives in clock.c and timer.c, this sleeps with hlt for the given number of microseconds
+void time_delay(int time) {
+    sleep_us((uint64_t)time);
 }
 
 
-//converts the registers values into microseconds used for our timer function
-double uptime_microseconds(void) {
-    hpet_poll_overflow();
 
-    uint32_t low = hpet_get_low();
-    uint32_t high = last_high + overflow_count * 0xFFFFFFFF;
+//console mux, output can go to the screen, COM1 or both. with no targets it goes nowhere
+int console_targets = CONSOLE_VGA | CONSOLE_SERIAL;
 
-    double total_ticks = (double)high * 4294967296.0 + (double)low;
-    return total_ticks * hpet_tick_microseconds;
-}
-
-
-void time_delay(int time) {
-    uint32_t start = uptime_microseconds();
-    uint32_t end = uptime_microseconds();
-    while (end - start < time){
-        end = uptime_microseconds();
-    }
-    return;
+//bench -q mutes just the thread it runs on, so printing doesn't skew the numbers and
+//everything else keeps its output
+static int muted(void) {
+    struct thread* t = this_cpu()->current;
+    return t && t->quiet;
 }
 
-
-
 //a few VGA functions that help control printing things properly
 void clear_screen() {
+    if (!(console_targets & CONSOLE_VGA) || muted()) return;
     for (int r=0;r<25;r++)
         for (int c=0;c<80;c++)
             VGA[r*80 + c] = (uint16_t)(' ' | ((uint16_t)color << 8));
@@ -124,11 +76,17 @@ void scroll_if_needed() {
 
 //our "print" functions, try to understand how they work as it is something we use a lot, but we will likely only briefly
 //cover this in our presentation
+//irqs off for the whole character so a thread switch can't leave the cursor half moved
 void putchar(char ch) {
-    if (ch == '\n') { cursor_col=0; cursor_row++; scroll_if_needed(); return; }
+    if (muted()) return;
+    if (console_targets & CONSOLE_SERIAL) serial_putc(ch);
+    if (!(console_targets & CONSOLE_VGA)) return;
+    uint32_t flags = irq_save();
+    if (ch == '\n') { cursor_col=0; cursor_row++; scroll_if_needed(); irq_restore(flags); return; }
     VGA[cursor_row*80 + cursor_col] = (uint16_t)ch | ((uint16_t)color << 8);
     cursor_col++;
     if (cursor_col >= 80) { cursor_col = 0; cursor_row++; scroll_if_needed(); }
+    irq_restore(flags);
 }
 
 
@@ -153,122 +111,94 @@ void print_uint(uint32_t num) {
     puts(&buf[i]);
 }
 
+void print_padded(uint32_t num, int width) {
+    int digits = 1;
+    for (uint32_t t = num; t >= 10; t /= 10) digits++;
+    for (int i = digits; i < width; i++) putchar(' ');
+    print_uint(num);
+}
 
-//current keyboard system, we don't have much time to change so understand how it works, I will go
-//over it a couple times
-static int shift_pressed = 0;
-
-static const char keymap_normal[128] = {
-    0,  27,'1','2','3','4','5','6','7','8','9','0','-','=', '\b',
-    '\t','q','w','e','r','t','y','u','i','o','p','[',']','\n',0,
-    'a','s','d','f','g','h','j','k','l',';','\'','`',0,'\\','z',
-    'x','c','v','b','n','m',',','.','/',0,'*',
-    0,0,0,0,0,0,0,' ',0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
-};
-
-static const char keymap_shift[128] = {
-    0,  27,'!','@','#','$','%','^','&','*','(',')','_','+', '\b',
-    '\t','Q','W','E','R','T','Y','U','I','O','P','{','}','\n',0,
-    'A','S','D','F','G','H','J','K','L',':','"','~',0,'|','Z',
-    'X','C','V','B','N','M','<','>','?','*',
-    0,0,0,0,0,0,0,' ',0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
-};
-
-
-#define KEY_UP     0xE048
-#define KEY_DOWN   0xE050
-#define KEY_LEFT   0xE04B
-#define KEY_RIGHT  0xE04D
-
-
-
-int getkey() {
-    static int e0_prefix = 0;
-    uint8_t sc;
-
-    while (1) {
-        uint8_t status = inb(0x64);
-        if (!(status & 1)) continue;
-
-        sc = inb(0x60);
-
-        if (sc == 0xE0) {
-            e0_prefix = 1;
-            continue;
-        }
-
-        // Key release
-        if (sc & 0x80) {
-            sc &= 0x7F;
-            if (sc == 42 || sc == 54) shift_pressed = 0;
-            e0_prefix = 0;
-            continue;
-        }
-
-        // Handle shift press
-        if (sc == 42 || sc == 54) {
-            shift_pressed = 1;
-            e0_prefix = 0;
-            continue;
-        }
-
-        if (e0_prefix) {
-            e0_prefix = 0;
-            switch (sc) {
-                case 0x48: return KEY_UP;
-                case 0x50: return KEY_DOWN;
-                case 0x4B: return KEY_LEFT;
-                case 0x4D: return KEY_RIGHT;
-                default: continue;
-            }
-        }
+//same thing for 64 bit numbers, split into 32 bit divides since we don't link libgcc
+void print_uint64(uint64_t num) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
 
-        // Regular spacebar
-        if (sc == 57) return ' ';
+    if (num == 0) {
+        putchar('0');
+        return;
+    }
 
-        // Normal keys
-        if (sc < 128) {
-            char c = shift_pressed ? keymap_shift[sc] : keymap_normal[sc];
-            if (c != 0) return c;
-        }
+    while (num > 0 && i > 0) {
+        uint32_t digit;
+        num = div64_u32(num, 10, &digit);
+        buf[--i] = '0' + digit;
     }
-}
 
+    puts(&buf[i]);
+}
 
+//prints a number as 0x followed by 8 hex digits, for addresses
+void print_hex(uint32_t num) {
+    puts("0x");
+    for (int i = 28; i >= 0; i -= 4) putchar("0123456789abcdef"[(num >> i) & 0xF]);
+}
 
+//prints nanoseconds as microseconds with three decimals, ex 1234.567
+void print_ns_as_us(uint64_t ns) {
+    uint32_t frac;
+    print_uint64(div64_u32(ns, 1000, &frac));
+    putchar('.');
+    putchar('0' + frac / 100);
+    putchar('0' + (frac / 10) % 10);
+    putchar('0' + frac % 10);
+}
 
 
 //The user system I created I will cover this briefly, but file system is more important to understand
 //and will give a better idea of what this is doing
-#define MAX_USERS 8
 #define MAX_USERNAME 16
 #define MAX_PASSWORD 16
 
-//user structure/class
-typedef struct {
+//user structure/class, users come from a slab cache and are kept in a list in the order they were added
+typedef struct user {
     char name[MAX_USERNAME];
-    char* password;
+    char* password; //kmalloc'd copy
+    struct user* next;
 } user_t;
 
-static user_t users[MAX_USERS];
-static int user_count = 0;
+static struct kmem_cache* user_cache;
+static user_t* users = 0;
+static user_t* users_tail = 0;
 
 
 user_t* find_user(const char* name) {
-    for (int i=0;i<user_count;i++) if (strcmp(users[i].name, name)==0) return &users[i];
+    for (user_t* u = users; u; u = u->next) if (strcmp(u->name, name)==0) return u;
     return 0;
 }
 
-void user_create(const char* name, const char* password) {
-    if (user_count >= MAX_USERS) return;
+//keeps its own copy, enter_password hands back the same static buffer every time
+void user_set_password(user_t* u, const char* password) {
+    char* copy = kstrdup(password);
+    if (!copy) return;
+    kfree(u->password);
+    u->password = copy;
+}
 
-    user_t* u = &users[user_count++];
+void user_create(const char* name, const char* password) {
+    user_t* u = kmem_cache_alloc(user_cache);
+    if (!u) return;
 
     int i=0; while (i<MAX_USERNAME-1 && name[i]) { u->name[i]=name[i]; i++; } u->name[i]=0;
 
-    int j=0; while (j<MAX_PASSWORD-1 && password[j]) { u->password[j]=password[j]; j++; } u->password[j]=0;
+    u->password = 0;
+    user_set_password(u, password);
+    if (!u->password) { kmem_cache_free(user_cache, u); return; }
 
-     
+    u->next = 0;
+    if (users_tail) users_tail->next = u;
+    else users = u;
+    users_tail = u;
 }
 
 char* enter_password() {
@@ -303,78 +233,67 @@ char* enter_password() {
 }
 
 void user_init() {
+    user_cache = kmem_cache_create("user", sizeof(user_t), 0, 0);
     user_create("default", "password");
     user_create("bob", "bob");
 }
 
 
 
-//Our filesystem, make sure to understand it as it is probably the most directly related to the class
-//I will cover this the most 
-#define MAX_FILES 64
-#define MAX_NAME 16
-#define MAX_FILE_SIZE 0x1000 //all files are assumed to be 4kb 
-#define FS_START_ADDR 0x400000 //start of the memory we use for our filesystem
-
-//file structure/class
+//crc32 (the zlib/ethernet one) of one file, cksum spawns one of these per file
+//jobs hold a handle, not the file, so one removed meanwhile shows up as gone instead of as freed memory
 typedef struct {
-    char name[MAX_NAME];
-    uint8_t *data;
+    fs_handle_t h;
+    int gone;
+    uint32_t crc;
     uint32_t size;
-} file_t;
-static file_t files[MAX_FILES];
-static int file_count = 0;
-static uint32_t next_alloc = 0;
-
-//loops through array of files to find one with matching name
-file_t* find_file(const char* name) {
-    for (int i=0;i<file_count;i++) if (strcmp(files[i].name, name)==0) return &files[i];
-    return 0;
+    uint32_t cpu;
+} cksum_work_t;
+
+//start with 0xFFFFFFFF and invert at the end, in between it can be fed a piece at a time
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return crc;
 }
 
-//creates a file in our ram filesystem
-void fs_create(const char* name, const uint8_t* data, uint32_t size) {
-    if (file_count >= MAX_FILES || next_alloc >= MAX_FILES) return;
-
-    if (size > MAX_FILE_SIZE) size = MAX_FILE_SIZE;
-
-    file_t* f = &files[file_count++];
-
-    int i=0; while (i<MAX_NAME-1 && name[i]) { f->name[i]=name[i]; i++; } f->name[i]=0;
-
-    uint8_t* mem = (uint8_t*)(FS_START_ADDR + (next_alloc*MAX_FILE_SIZE));
-    next_alloc++;
-
-    f->data = mem;
-    f->size = size;
-
-    for (uint32_t j=0;j<size;j++) mem[j]=data ? data[j] : 0;
-
-    
-    for (uint32_t j = size; j < MAX_FILE_SIZE; j++) mem[j] = 0;
-        
+//runs on whatever cpu picks it up, where nothing stops the file being removed, so it works
+//from a copy of the extent list. a file rewritten meanwhile hashes whatever its old blocks hold
+static void cksum_job(void* arg) {
+    cksum_work_t* w = arg;
+    struct extent ext[KMALLOC_MAX / sizeof(struct extent)]; //as many as a file can have
+    uint32_t count, size;
+    w->cpu = this_cpu()->index;
+    w->gone = fs_snapshot(w->h, ext, KMALLOC_MAX / sizeof(struct extent), &count, &size) < 0;
+    if (w->gone) return;
+    uint32_t crc = 0xFFFFFFFF, left = size;
+    for (uint32_t i = 0; i < count && left; i++) {
+        uint32_t len = ext[i].count * FS_BLOCK < left ? ext[i].count * FS_BLOCK : left;
+        crc = crc32_update(crc, fs_block(ext[i].start), len);
+        left -= len;
+    }
+    w->crc = ~crc;
+    w->size = size;
 }
 
-//adds data to an existing file
-void fs_write(file_t* f, const uint8_t* data, uint32_t size) {
-    if (!f || !f->data || !data) return;
-
-    if (size > MAX_FILE_SIZE) size = MAX_FILE_SIZE;
-    
-    for(uint32_t i=0;i < size; i++) f->data[i] = data[i];
 
-    f->size = size;
 
+//per thread scratch memory for command handlers, run_command gives it all back when the handler returns
+static struct arena* scratch(void) {
+    return &thread_current()->scratch;
 }
 
-void fs_init() {
-    const char *hello = "Welcome to LuxOS!\nType 'help' for commands.\n";
-    fs_create("welcome.txt", (const uint8_t*)hello, (uint32_t)45);
-    const char *readme = "This is a tiny RAM filesystem. Use 'ls' and 'cat'.\n";
-    fs_create("readme.txt", (const uint8_t*)readme, (uint32_t)39);
+//a file's extents copied into one zero terminated scratch buffer, 0 when out of memory
+static char* file_contents(const file_t* f) {
+    char* buf = arena_alloc(scratch(), f->size + 1);
+    if (!buf) return 0;
+    fs_read(f, 0, buf, f->size);
+    buf[f->size] = 0;
+    return buf;
 }
 
-
 void edit_file(const char* filename) {
     file_t* f = find_file(filename);
 
@@ -382,24 +301,16 @@ void edit_file(const char* filename) {
     puts("=== Simple Text Editor ===\n");
     puts("Type your text. Enter ':save' on a new line to save & exit.\n\n");
 
-    // Display contents
-    if (f->data && f->size > 0) {
-        for (uint32_t i = 0; i < f->size; i++) {
-            putchar(((char*)f->data)[i]);
-        }
-    }
+    //both grow in the scratch arena as needed
+    uint32_t cap = f->size + 1024, len = f->size;
+    char* buffer = arena_alloc(scratch(), cap);
+    uint32_t line_cap = 128, pos = 0;
+    char* input_line = arena_alloc(scratch(), line_cap);
+    if (!buffer || !input_line) { puts("out of memory\n"); return; }
+    fs_read(f, 0, buffer, len);
 
-    char buffer[2048];
-    uint32_t len = 0;
-
-
-    if (f->data && f->size < sizeof(buffer)) {
-        for (uint32_t i = 0; i < f->size; i++)
-            buffer[len++] = f->data[i];
-    }
-
-    char input_line[128];
-    int pos = 0;
+    // Display contents
+    for (uint32_t i = 0; i < len; i++) putchar(buffer[i]);
 
     while (1) {
         char c = getkey();
@@ -411,7 +322,14 @@ void edit_file(const char* filename) {
                 break;
 
             
-            for (int i = 0; i < pos && len < sizeof(buffer) - 1; i++)
+            if (len + pos + 1 > cap) {
+                uint32_t new_cap = (len + pos + 1) * 2;
+                char* grown = arena_grow(scratch(), buffer, cap, new_cap);
+                if (!grown) { puts("\nout of memory, line dropped\n"); pos = 0; continue; }
+                buffer = grown;
+                cap = new_cap;
+            }
+            for (uint32_t i = 0; i < pos; i++)
                 buffer[len++] = input_line[i];
             buffer[len++] = '\n';
 
@@ -427,14 +345,18 @@ void edit_file(const char* filename) {
             }
         }
         else {
-            if (pos < sizeof(input_line) - 1) {
-                input_line[pos++] = c;
-                putchar(c);
+            if (pos + 1 == line_cap) {
+                char* grown = arena_grow(scratch(), input_line, line_cap, line_cap * 2);
+                if (!grown) continue;
+                input_line = grown;
+                line_cap *= 2;
             }
+            input_line[pos++] = c;
+            putchar(c);
         }
     }
 
-    fs_write(f, (uint8_t*)buffer, len);
+    if (fs_write(f, (uint8_t*)buffer, len) < 0) { puts("\nfilesystem full, file not saved\n"); return; }
     puts("\nFile saved and closed.\n");
 }
 
@@ -442,8 +364,7 @@ void edit_file(const char* filename) {
 
 //converts uptime into hours, minutes, seconds
 void print_uptime(void) {
-    double up = uptime_seconds();
-    int total = (int)up;
+    uint32_t total = uptime_seconds();
     int hours = total / 3600;
     int minutes = (total % 3600) / 60;
     int seconds = total % 60;
@@ -461,6 +382,142 @@ void print_uptime(void) {
 
 
 
+
+//bench keeps every sample so it can report percentiles, not just an average
+#define BENCH_MAX_SAMPLES 1000
+static uint64_t bench_ns[BENCH_MAX_SAMPLES];
+static uint64_t bench_cycles[BENCH_MAX_SAMPLES];
+static int bench_running = 0;
+
+//reads a decimal number and moves p past it and any spaces after it
+static uint32_t parse_uint(const char** p) {
+    uint32_t n = 0;
+    while (**p >= '0' && **p <= '9') { n = n * 10 + (**p - '0'); (*p)++; }
+    while (**p == ' ') (*p)++;
+    return n;
+}
+
+//insertion sort, the sample counts are small and this keeps it simple
+static void sort_u64(uint64_t* a, int n) {
+    for (int i = 1; i < n; i++) {
+        uint64_t v = a[i];
+        int j = i - 1;
+        while (j >= 0 && a[j] > v) { a[j+1] = a[j]; j--; }
+        a[j+1] = v;
+    }
+}
+
+//nearest rank percentile of a sorted array
+static uint64_t percentile(const uint64_t* a, int n, int p) {
+    int idx = (p * n + 99) / 100 - 1;
+    if (idx < 0) idx = 0;
+    return a[idx];
+}
+
+static uint64_t isqrt64(uint64_t v) {
+    uint64_t res = 0, bit = 1ULL << 62;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= res + bit) { v -= res + bit; res = (res >> 1) + bit; }
+        else res >>= 1;
+        bit >>= 2;
+    }
+    return res;
+}
+
+//standard deviation without overflowing, the differences get scaled down so their squares fit
+static uint64_t stddev_u64(const uint64_t* a, int n, uint64_t mean) {
+    uint64_t maxdiff = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t d = a[i] > mean ? a[i] - mean : mean - a[i];
+        if (d > maxdiff) maxdiff = d;
+    }
+    int shift = 0;
+    while ((maxdiff >> shift) >= (1ULL << 26)) shift++;
+
+    uint64_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t d = (a[i] > mean ? a[i] - mean : mean - a[i]) >> shift;
+        sum += d * d;
+    }
+    return isqrt64(div64_u32(sum, n, 0)) << shift;
+}
+
+static void bench_line(const char* label, uint64_t ns, uint64_t cycles) {
+    puts(label);
+    print_ns_as_us(ns);
+    puts(" us   ");
+    print_uint64(cycles);
+    puts(" cycles\n");
+}
+
+static void bench_command(const char* args) {
+    uint32_t runs = 20, warmup = 2;
+    int quiet = 0;
+
+    while (*args == '-') {
+        char flag = args[1];
+        args += 2;
+        while (*args == ' ') args++;
+        if (flag == 'n') runs = parse_uint(&args);
+        else if (flag == 'w') warmup = parse_uint(&args);
+        else if (flag == 'q') quiet = 1;
+        else { puts("bench: unknown option\n"); return; }
+    }
+    if (!*args || runs == 0) {
+        puts("usage: bench [-n runs] [-w warmup] [-q] <command>\n");
+        return;
+    }
+    if (runs > BENCH_MAX_SAMPLES) runs = BENCH_MAX_SAMPLES;
+    if (bench_running) { puts("bench can't be nested\n"); return; }
+    bench_running = 1;
+
+    struct thread* self = thread_current();
+    uint8_t old_quiet = self->quiet;
+    if (quiet) self->quiet = 1;
+
+    for (uint32_t j = 0; j < warmup; j++) run_command(args);
+
+    for (uint32_t j = 0; j < runs; j++) {
+        uint64_t start = clock_ns();
+        uint64_t c0 = rdtsc();
+
+        run_command(args);
+
+        uint64_t c1 = rdtsc();
+        uint64_t end = clock_ns();
+        bench_ns[j] = end - start;
+        bench_cycles[j] = c1 - c0;
+    }
+
+    self->quiet = old_quiet;
+    bench_running = 0;
+
+    uint64_t total = 0;
+    for (uint32_t j = 0; j < runs; j++) total += bench_ns[j];
+    uint64_t mean = div64_u32(total, runs, 0);
+    uint64_t sd = stddev_u64(bench_ns, runs, mean);
+
+    sort_u64(bench_ns, runs);
+    sort_u64(bench_cycles, runs);
+
+    puts("runs: ");
+    print_uint(runs);
+    puts(" (+");
+    print_uint(warmup);
+    puts(" warmup)\n");
+    bench_line("min:    ", bench_ns[0], bench_cycles[0]);
+    bench_line("median: ", percentile(bench_ns, runs, 50), percentile(bench_cycles, runs, 50));
+    bench_line("p90:    ", percentile(bench_ns, runs, 90), percentile(bench_cycles, runs, 90));
+    bench_line("p99:    ", percentile(bench_ns, runs, 99), percentile(bench_cycles, runs, 99));
+    bench_line("max:    ", bench_ns[runs-1], bench_cycles[runs-1]);
+    puts("mean:   ");
+    print_ns_as_us(mean);
+    puts(" us\nstddev: ");
+    print_ns_as_us(sd);
+    puts(" us\n");
+}
+
 // the start of our command line. also pretty important to understand but fairly simple
 //I'll still cover it a bit
 #define MAX_INPUT 128
@@ -483,13 +540,37 @@ const char* prompt = "luxos_root$";
 
 void cli_prompt() { puts(prompt); puts ("> "); }
 
+static void run_command_inner(const char* raw_cmd);
+
+//wrapper so the trace gets one enter/exit pair per command no matter where the handler returns
 void run_command(const char* raw_cmd) {
-    char cmd[128];
-    int i = 0;
+    struct thread* self = thread_current();
+    while (*raw_cmd == ' ') raw_cmd++;
+    uint32_t tag = trace_tag(raw_cmd);
+
+    //a nested run_command (timer, average, bench) only gives back what its own command took
+    arena_mark_t mark = arena_mark(scratch());
+
+    self->cmd_depth++;
+    TRACE(TRACE_CMD_ENTER, tag, self->cmd_depth);
+    run_command_inner(raw_cmd);
+    TRACE(TRACE_CMD_EXIT, tag, self->cmd_depth);
+    self->cmd_depth--;
 
+    arena_release(scratch(), mark);
+}
+
+//a bg thread gets its own kstrdup'd copy of the command line, the name is only for ps
+static void bg_thread(void* arg) {
+    run_command(arg);
+    kfree(arg);
+}
+
+static void run_command_inner(const char* raw_cmd) {
     while (*raw_cmd == ' ') raw_cmd++;
-    while (*raw_cmd && i < 127) cmd[i++] = *raw_cmd++;
-    cmd[i] = 0;
+    char* cmd = arena_strdup(scratch(), raw_cmd);
+    if (!cmd) { puts("out of memory\n"); return; }
+    int i = strlen(cmd);
 
     while (i > 0 && (cmd[i-1]==' '||cmd[i-1]=='\n'||cmd[i-1]=='\r')) cmd[--i]=0;
 
@@ -509,11 +590,18 @@ if (help_args) {
         puts("usage: help <command>\n");
         puts("Available commands:\n");
         puts("  help [command]\n");
-        puts("  ls\n");
+        puts("  ls [dir]\n");
+        puts("  mkdir <dir>\n");
+        puts("  cd [dir]\n");
+        puts("  pwd\n");
         puts("  cat <file>\n");
-        puts("  echo <text> > <file>\n");
+        puts("  echo <text> >[>] <file>\n");
         puts("  touch <file>\n");
         puts("  rm <file>\n");
+        puts("  mv <file> <new path>\n");
+        puts("  cksum [file]\n");
+        puts("  sync\n");
+        puts("  disk\n");
         puts("  hello\n");
         puts("  clear screen\n");
         puts("  about\n");
@@ -521,23 +609,40 @@ if (help_args) {
         puts("  showusers\n");
         puts("  adduser\n");
         puts("  timer\n");
+        puts("  bench\n");
+        puts("  perf\n");
+        puts("  trace\n");
+        puts("  console\n");
+        puts("  irqstat\n");
+        puts("  smp\n");
+        puts("  cpus\n");
+        puts("  bg <command>\n");
+        puts("  ps\n");
         puts("  animation\n");
         puts("  luxosay\n");
         puts("  passwd\n");
         puts("  color\n");
         puts("  rainbow\n");
         puts("  free\n");
+        puts("  slabinfo\n");
         puts("  uptime\n");
         puts("  head\n");
         puts("  tail\n");
         return; }
       
     if(strcmp(help_args, "help") == 0) {puts("help [command] - shows a list of all commands or info about one command.\n");return;}
-    if(strcmp(help_args, "ls") == 0) {puts("Lists all files in the RAM filesystem. \n"); return;}
+    if(strcmp(help_args, "ls") == 0) {puts("Use: ls [dir] - Lists a directory, the current one by default. Directories end in /.\n"); return;}
+    if(strcmp(help_args, "sync") == 0) {puts("Use: sync - Saves every file and directory to the disk (qemu -hda) so they are back after a reboot.\n A blank disk, or one without a LuxOS filesystem, gets formatted.\n"); return;}
+    if(strcmp(help_args, "disk") == 0) {puts("Use: disk - Shows the ata disk, whether it uses dma, and how much has been read and written.\n"); return;}
+    if(strcmp(help_args, "mkdir") == 0) {puts("Use: mkdir <dir> - Makes a directory, its parent has to exist already.\n"); return;}
+    if(strcmp(help_args, "cd") == 0) {puts("Use: cd [dir] - Changes the current directory, / without a dir. .. is the parent.\n"); return;}
+    if(strcmp(help_args, "pwd") == 0) {puts("Prints the current directory.\n"); return;}
+    if(strcmp(help_args, "cksum") == 0) {puts("Use: cksum [file] - Prints the crc32 of a file, or of every file.\n The files are checksummed in parallel on all cpu cores.\n"); return;}
     if(strcmp(help_args, "cat") == 0) {puts("Displays the contents of a file.\n"); return;}
-    if(strcmp(help_args, "echo") == 0) {puts("Writes the given text into a new file.\n"); return;}
+    if(strcmp(help_args, "echo") == 0) {puts("Use: echo <text> > <file> - Writes the given text into a file, >> adds it to the end instead.\n"); return;}
     if(strcmp(help_args, "touch") == 0) {puts("Creates an empty file with the given name.\n"); return;}
-    if(strcmp(help_args, "rm") == 0) {puts("Removes file from RAM Filesystem \n"); return;}
+    if(strcmp(help_args, "rm") == 0) {puts("Removes a file or an empty directory from RAM Filesystem \n"); return;}
+    if(strcmp(help_args, "mv") == 0) {puts("Use: mv <file> <new path> - Renames or moves a file or directory.\n If the new path is a directory it goes inside, otherwise the path can't be taken.\n"); return;}
     if(strcmp(help_args, "hello") == 0) {puts("Greets the user \n");return;}
     if(strcmp(help_args, "clear") == 0) { puts("Clears terminal display \n"); return;}
     if(strcmp(help_args, "about") == 0) {puts("Displays information about the OS \n"); return; }
@@ -545,13 +650,23 @@ if (help_args) {
     if(strcmp(help_args, "su") == 0) {puts("Use: su <username> - Switches users\n"); return;}
     if(strcmp(help_args, "showusers") == 0) {puts("Use: showusers - Prints list of all users\n"); return;}
     if(strcmp(help_args, "addusers") == 0) {puts("Use: addusers - Adds a new user to OS\n"); return;}
+    if(strcmp(help_args, "bench") == 0) {puts("Use: bench [-n runs] [-w warmup] [-q] <command> - Can only be used by root.\n Runs a command many times and prints min/median/p90/p99/max/stddev. -q hides its output.\n"); return;}
+    if(strcmp(help_args, "perf") == 0) {puts("Use: perf record [-g] <command> | start [-g] | stop | top | report | flame | reset\n Samples where the kernel spends its time and lists the hottest functions.\n -g also records call stacks, perf flame sends them out COM1 as folded stacks.\n"); return;}
+    if(strcmp(help_args, "trace") == 0) {puts("Use: trace start | stop | dump | clear\n Records timestamped events (irqs, commands, file lookups, keys). dump sends them out COM1.\n"); return;}
+    if(strcmp(help_args, "console") == 0) {puts("Use: console vga | serial | both - Picks where output goes. serial is COM1.\n"); return;}
+    if(strcmp(help_args, "irqstat") == 0) {puts("Use: irqstat [reset] - Shows how often each interrupt fired, how long its handler took,\n and how late timer interrupts arrived after their deadline.\n"); return;}
+    if(strcmp(help_args, "smp") == 0) {puts("Use: smp - Shows how many cpu cores are online.\n"); return;}
+    if(strcmp(help_args, "cpus") == 0) {puts("Use: cpus - Lists every cpu core with its apic id, interrupts taken, idle time and uptime.\n"); return;}
+    if(strcmp(help_args, "bg") == 0) {puts("Use: bg <command> - Runs a command in its own thread so the prompt stays usable.\n"); return;}
+    if(strcmp(help_args, "ps") == 0) {puts("Use: ps - Lists the kernel threads and how much cpu time each one has used.\n"); return;}
     if(strcmp(help_args, "timer") == 0) {puts("Use: timer <command> - Can only be used by root.\n Times how long a function runs. \n"); return;}
     if(strcmp(help_args, "animation") == 0) {puts("Use: animation <number(1-5)> - Select an animation to play.\n"); return;}
     if(strcmp(help_args, "luxosay") == 0) {puts("Use: luxosay <-a> <message> - Displays Luxo saying your message.\n Try different -args to get different eyes.\n"); return;}
     if(strcmp(help_args, "passwd") == 0) {puts("Use: passwd <username> - Changes users password. Must be run by the user or root.\n"); return;}
     if(strcmp(help_args, "color") == 0) {puts("Use: color <color name> - Changes text color to given color.\n"); return;}
     if(strcmp(help_args, "rainbow") == 0) {puts("Use: rainbow <message> - Displays the given message in rainbow text.\n"); return;}
-    if(strcmp(help_args, "free") == 0) {puts("Displays amount of free memory in the system.\n"); return;}
+    if(strcmp(help_args, "free") == 0) {puts("Displays how much memory is free and used, from the map grub hands the kernel.\n"); return;}
+    if(strcmp(help_args, "slabinfo") == 0) {puts("Shows every slab cache: object size, objects in use, pages held and allocations.\n"); return;}
     if(strcmp(help_args, "uptime") == 0) {puts("Prints how long the kernel has been running.\n"); return;}
     if(strcmp(help_args, "head") == 0) {puts("Use: head <file> - Displays the first 5 lines of a file.\n"); return;}
     if(strcmp(help_args, "tail") == 0) {puts("Use: tail <file> - Displays the last 5 lines of a file.\n"); return;}
@@ -559,13 +674,53 @@ if (help_args) {
     }
 
 
-    if (strcmp(cmd,"ls")==0) {
-        for (int i=0;i<file_count;i++) { puts(files[i].name); puts("\n"); }
+    const char* ls_args = cmd_args(cmd, "ls");
+    if (ls_args) {
+        file_t* d = *ls_args ? fs_lookup(ls_args) : fs_cwd();
+        if (!d) { puts("no such directory\n"); return; }
+        if (!d->is_dir) { puts(d->name); puts("\n"); return; }
+        for (file_t* f = d->first_child; f; f = f->next) { puts(f->name); puts(f->is_dir ? "/\n" : "\n"); }
+        return;
+    }
+
+    const char* mkdir_args = cmd_args(cmd, "mkdir");
+    if (mkdir_args) {
+        if (!*mkdir_args) { puts("usage: mkdir <dir>\n"); return; }
+        if (!fs_mkdir(mkdir_args)) puts(fs_lookup(mkdir_args) ? "already exists\n" : "could not create directory\n");
+        return;
+    }
+
+    const char* cd_args = cmd_args(cmd, "cd");
+    if (cd_args) {
+        int err = fs_chdir(*cd_args ? cd_args : "/");
+        if (err) { puts(fs_strerror(err)); puts("\n"); }
+        return;
+    }
+
+    if (strcmp(cmd,"sync")==0) {
+        uint32_t skipped;
+        int n = fs_sync(&skipped);
+        if (n < 0) { puts(fs_strerror(n)); puts("\n"); return; }
+        puts("synced, ");
+        print_uint(n);
+        puts(" files written\n");
+        if (skipped) { print_uint(skipped); puts(" didn't fit in the disk's inode table, they're only in ram\n"); }
+        return;
+    }
+
+    if (strcmp(cmd,"disk")==0) {
+        ata_print();
+        return;
+    }
+
+    if (strcmp(cmd,"pwd")==0) {
+        puts(fs_getcwd());
+        puts("\n");
         return;
     }
 
     if (strcmp(cmd,"showusers")==0) {
-        for (int i=0;i<user_count;i++) { puts(users[i].name); puts("\n"); }
+        for (user_t* u = users; u; u = u->next) { puts(u->name); puts("\n"); }
         return;
     }
 
@@ -887,7 +1042,7 @@ if(passwd_args) {
         return;
     }
 
-    u->password = pwd1;
+    user_set_password(u, pwd1);
 
     return;
     
@@ -1071,7 +1226,10 @@ if (cat_args) {
     if(!*cat_args){ puts("usage: cat <file>\n"); return; }
     file_t* f = find_file(cat_args);
     if(!f){ puts("file not found\n"); return; }
-    puts((char*)f->data);
+    uint32_t len;
+    const uint8_t* p;
+    for (uint32_t i = 0; (p = fs_extent(f, i, &len)); i++)
+        for (uint32_t j = 0; j < len; j++) putchar(p[j]);
     putchar('\n');
     return;
 }
@@ -1081,11 +1239,13 @@ if (head_args) {
     if(!*head_args){ puts("usage: head <file>\n"); return; }
     file_t* f = find_file(head_args);
     if(!f){ puts("file not found\n"); return; }
+    char* data = file_contents(f);
+    if(!data){ puts("out of memory\n"); return; }
 
     int lines = 0;
     for (uint32_t i = 0; i < f->size; i++) {
-        putchar(((char*)f->data)[i]);
-        if (((char*)f->data)[i] == '\n') {
+        putchar(data[i]);
+        if (data[i] == '\n') {
             lines++;
             if (lines >= 5) break;
         }
@@ -1098,10 +1258,12 @@ if (tail_args) {
     if(!*tail_args){ puts("usage: tail <file>\n"); return; }
     file_t* f = find_file(tail_args);
     if(!f){ puts("file not found\n"); return; }
+    char* data = file_contents(f);
+    if(!data){ puts("out of memory\n"); return; }
 
     int lines = 0;
     for (uint32_t i = 0; i < f->size; i++) {
-        if (((char*)f->data)[i] == '\n') {
+        if (data[i] == '\n') {
             lines++;
         }
     }
@@ -1110,9 +1272,9 @@ if (tail_args) {
     int current_line = 0;
     for (uint32_t i = 0; i < f->size; i++) {
         if (current_line >= start_line) {
-            putchar(((char*)f->data)[i]);
+            putchar(data[i]);
         }
-        if (((char*)f->data)[i] == '\n') {
+        if (data[i] == '\n') {
             current_line++;
         }
     }
@@ -1123,7 +1285,7 @@ if (tail_args) {
     const char* touch_args = cmd_args(cmd, "touch");
 if (touch_args) {
     if(!*touch_args){ puts("usage: touch <file>\n"); return; }
-    fs_create(touch_args, 0, 0);
+    if(!find_file(touch_args) && !fs_create(touch_args, 0, 0)) puts("could not create file\n");
     return;
 }
 
@@ -1131,17 +1293,59 @@ if (touch_args) {
     const char* rm_args = cmd_args(cmd, "rm");
 if (rm_args) {
     if(!*rm_args){ puts("usage: rm <file>\n"); return; }
-    for(int i=0;i<file_count;i++){
-        if(strcmp(files[i].name,rm_args)==0){
-            for(int k=i;k<file_count-1;k++) files[k]=files[k+1];
-            file_count--;
-            return;
-        }
-    }
-    puts("file not found\n");
+    int err = fs_remove(rm_args);
+    if(err){ puts(fs_strerror(err)); puts("\n"); }
+    return;
+}
+
+    const char* mv_args = cmd_args(cmd, "mv");
+if (mv_args) {
+    const char* to = mv_args; while(*to && *to!=' ') to++;
+    int n = to - mv_args;
+    while(*to==' ') to++;
+    if(!n || !*to){ puts("usage: mv <file> <new path>\n"); return; }
+    char* from = arena_alloc(scratch(), n + 1);
+    if(!from){ puts("out of memory\n"); return; }
+    memcpy(from, mv_args, n);
+    from[n]=0;
+    int err = fs_rename(from, to);
+    if(err){ puts(fs_strerror(err)); puts("\n"); }
     return;
 }
 
+    const char* cksum_args = cmd_args(cmd, "cksum");
+if (cksum_args) {
+    uint32_t count = *cksum_args ? 1 : fs_count();
+    cksum_work_t* work = arena_alloc(scratch(), count * sizeof(cksum_work_t));
+    struct job* jobs = arena_alloc(scratch(), count * sizeof(struct job));
+    const char** names = arena_alloc(scratch(), count * sizeof(char*));
+    if (!work || !jobs || !names) { puts("out of memory\n"); return; }
+    uint32_t n = 0, pos = 0;
+    file_t* f = *cksum_args ? find_file(cksum_args) : fs_next(&pos);
+    while (f && n < count) {
+        if (f->is_dir) { f = fs_next(&pos); continue; } //only when walking everything, find_file never returns one
+        names[n] = arena_strdup(scratch(), f->name);
+        work[n].h = fs_handle(f);
+        spawn(&jobs[n], cksum_job, &work[n]);
+        n++;
+        f = *cksum_args ? 0 : fs_next(&pos);
+    }
+    if (n == 0) { puts(*cksum_args ? "file not found\n" : "no files\n"); return; }
+
+    for (uint32_t i = 0; i < n; i++) join(&jobs[i]);
+    for (uint32_t i = 0; i < n; i++) {
+        if (work[i].gone) { puts("removed    "); puts(names[i] ? names[i] : "?"); puts("\n"); continue; }
+        print_hex(work[i].crc);
+        puts("  ");
+        print_uint(work[i].size);
+        puts("  ");
+        puts(names[i] ? names[i] : "?");
+        puts("  (cpu ");
+        print_uint(work[i].cpu);
+        puts(")\n");
+    }
+    return;
+}
 
     const char* start = cmd_args(cmd, "echo");
 if (start) {
@@ -1149,26 +1353,26 @@ if (start) {
     while(*arrow){ if(*arrow=='>'){ gt=arrow; break; } arrow++; }
     if(!gt){ puts("usage: echo <text> > <file>\n"); return; }
 
-    const char* fn=gt+1; while(*fn==' ') fn++;
+    int append = gt[1]=='>'; //>> adds to the end instead of replacing
+    const char* fn=gt+1+append; while(*fn==' ') fn++;
     if(!*fn){ puts("no filename\n"); return; }
 
-    char name[32]; int ni=0;
-    while(*fn && *fn!=' ' && ni<31) {
-        name[ni++]=*fn++; 
-    }
-    
+    int ni=0; while(fn[ni] && fn[ni]!=' ') ni++;
+    char* name = arena_alloc(scratch(), ni + 1);
+    if(!name){ puts("out of memory\n"); return; }
+    memcpy(name, fn, ni);
+    name[ni]=0;
 
-    char textbuf[512]; int ti=0;
+    //the text goes straight from the command line into the file, no copy in between
     while(*start==' ') start++;
-    const char* end=gt; while(start<end && ti<511) textbuf[ti++]=*start++;
-    textbuf[ti]=0;
+    uint32_t ti = start < gt ? (uint32_t)(gt - start) : 0;
 
     file_t* f = find_file(name);
-    if(!f) fs_create(name,(const uint8_t*)textbuf,ti);
-    else{
-        name[ni+1]=0; name[ni+2]=0; 
-        fs_create(name,(const uint8_t*)textbuf,ti);
-    }
+    int ok;
+    if(!f) ok = fs_create(name,(const uint8_t*)start,ti) != 0;
+    else if(append) ok = fs_append(f,(const uint8_t*)start,ti) == 0;
+    else ok = fs_write(f,(const uint8_t*)start,ti) == 0;
+    if(!ok) puts(f ? "filesystem full\n" : "could not create file\n");
     return;
 }
 
@@ -1192,10 +1396,14 @@ if (edit_args) {
 
 
 if(strcmp(cmd,"free")==0) {
-    int size;
-    for (int i=0;i<file_count;i++) { size = size + 1; }
-    print_uint(size * 1000);
-    puts("/n");
+    pmm_print();
+    paging_print();
+    fs_print();
+    return;
+}
+
+if (strcmp(cmd,"slabinfo")==0) {
+    slab_print_stats();
     return;
 }
 
@@ -1215,15 +1423,14 @@ if (timer_args ) {
         puts("You do not have permissions to run this command\n");
         return;
     }
-    uint32_t start = uptime_microseconds();
+    uint64_t start = clock_ns();
 
     run_command(timer_args);
 
-    uint32_t end = uptime_microseconds();
+    uint64_t end = clock_ns();
 
-    uint32_t s = end - start;
     puts("Command took ");
-    print_uint(s);
+    print_ns_as_us(end - start);
     puts(" microseconds\n");
     return;
 }
@@ -1242,35 +1449,128 @@ if (average_args ) {
         return;
     }
 
-    uint32_t average_s = 0; 
+    uint64_t total_ns = 0; 
     for (int j = 0; j < 10; j++) {
-        uint32_t start = uptime_microseconds();
+        uint64_t start = clock_ns();
 
         run_command(average_args);
 
-        uint32_t end = uptime_microseconds();
+        uint64_t end = clock_ns();
 
-        uint32_t s = end - start;
-        average_s += s;
+        total_ns += end - start;
     }
     
     puts("Command took an average of ");
-    print_uint(average_s / 10);
+    print_ns_as_us(div64_u32(total_ns, 10, 0));
     puts(" microseconds\n");
     return;
 }
 
 
 
+    const char* perf_args = cmd_args(cmd, "perf");
+if (perf_args) {
+    const char* record_args = cmd_args(perf_args, "record");
+    if (record_args) {
+        int callgraph = 0;
+        const char* g_args = cmd_args(record_args, "-g");
+        if (g_args) { callgraph = 1; record_args = g_args; }
+        if (!*record_args) { puts("usage: perf record [-g] <command>\n"); return; }
+        profile_reset();
+        profile_start(callgraph);
+        run_command(record_args);
+        profile_stop();
+        profile_report(15);
+        return;
+    }
+    if (strcmp(perf_args, "start") == 0) { profile_reset(); profile_start(0); return; }
+    if (strcmp(perf_args, "start -g") == 0) { profile_reset(); profile_start(1); return; }
+    if (strcmp(perf_args, "flame") == 0) { profile_dump_folded(); return; }
+    if (strcmp(perf_args, "stop") == 0) { profile_stop(); return; }
+    if (strcmp(perf_args, "top") == 0 || strcmp(perf_args, "report") == 0) { profile_report(15); return; }
+    if (strcmp(perf_args, "reset") == 0) { profile_reset(); return; }
+    puts("usage: perf record [-g] <command> | start [-g] | stop | top | report | flame | reset\n");
+    return;
+}
+
+    const char* console_args = cmd_args(cmd, "console");
+if (console_args) {
+    if (strcmp(console_args, "vga") == 0) { console_targets = CONSOLE_VGA; return; }
+    if (strcmp(console_args, "serial") == 0) { console_targets = CONSOLE_SERIAL; return; }
+    if (strcmp(console_args, "both") == 0) { console_targets = CONSOLE_VGA | CONSOLE_SERIAL; return; }
+    puts("usage: console vga | serial | both\n");
+    return;
+}
+
+    const char* bg_args = cmd_args(cmd, "bg");
+if (bg_args) {
+    if (!*bg_args) { puts("usage: bg <command>\n"); return; }
+    char* line = kstrdup(bg_args);
+    if (!line) { puts("out of memory\n"); return; }
+    struct thread* t = thread_create(bg_args, bg_thread, line);
+    if (!t) { kfree(line); puts("too many threads\n"); return; }
+    puts("[");
+    print_uint(t->id);
+    puts("] ");
+    puts(bg_args);
+    puts("\n");
+    return;
+}
+
+    if (strcmp(cmd, "ps") == 0) {
+        threads_print();
+        return;
+    }
+
+    if (strcmp(cmd, "smp") == 0) {
+        smp_print_summary();
+        return;
+    }
+
+    if (strcmp(cmd, "cpus") == 0) {
+        smp_print_cpus();
+        return;
+    }
+
+    const char* irqstat_args = cmd_args(cmd, "irqstat");
+if (irqstat_args) {
+    if (strcmp(irqstat_args, "reset") == 0) { interrupt_reset_stats(); return; }
+    interrupt_print_stats();
+    return;
+}
+
+    const char* trace_args = cmd_args(cmd, "trace");
+if (trace_args) {
+    if (strcmp(trace_args, "start") == 0) { trace_start(); return; }
+    if (strcmp(trace_args, "stop") == 0) { trace_stop(); return; }
+    if (strcmp(trace_args, "dump") == 0) { trace_dump(); return; }
+    if (strcmp(trace_args, "clear") == 0) { trace_clear(); return; }
+    puts("usage: trace start | stop | dump | clear\n");
+    return;
+}
+
+    const char* bench_args = cmd_args(cmd, "bench");
+if (bench_args) {
+    if (strcmp(prompt, "luxos_root$") != 0){ //also requires root
+        puts("You do not have permissions to run this command\n");
+        return;
+    }
+    bench_command(bench_args);
+    return;
+}
+
+
+
     puts("unknown command\n");
 }
 
 
 //command history that allows me to scroll through previous commands you can ignore, its not important
-#define HISTORY_SIZE 15
+//entries are kstrdup'd so a long history only costs what was actually typed
+#define HISTORY_SIZE 64
 #define MAX_CMD_LEN 128
 
-static char command_history[HISTORY_SIZE][MAX_CMD_LEN];
+static char* command_history[HISTORY_SIZE];
 static int history_count = 0;
 static int history_index = -1;  
 
@@ -1278,20 +1578,16 @@ static int history_index = -1;
 void add_to_history(const char* cmd) {
     if (cmd[0] == 0) return;
 
-    if (history_count < HISTORY_SIZE) {
-        for (int i = 0; cmd[i] && i < MAX_CMD_LEN - 1; i++)
-            command_history[history_count][i] = cmd[i];
-        command_history[history_count][MAX_CMD_LEN - 1] = '\0';
-        history_count++;
-    } else {
-        for (int i = 1; i < HISTORY_SIZE; i++)
-            for (int j = 0; j < MAX_CMD_LEN; j++)
-                command_history[i - 1][j] = command_history[i][j];
+    char* copy = kstrdup(cmd);
+    if (!copy) return;
 
-        for (int i = 0; cmd[i] && i < MAX_CMD_LEN - 1; i++)
-            command_history[HISTORY_SIZE - 1][i] = cmd[i];
-        command_history[HISTORY_SIZE - 1][MAX_CMD_LEN - 1] = '\0';
+    if (history_count == HISTORY_SIZE) {
+        kfree(command_history[0]);
+        for (int i = 1; i < HISTORY_SIZE; i++)
+            command_history[i - 1] = command_history[i];
+        history_count--;
     }
+    command_history[history_count++] = copy;
 }
 
 void recall_command(int index, char* buffer, int* buf_index) {
@@ -1313,20 +1609,53 @@ void recall_command(int index, char* buffer, int* buf_index) {
 
 // the main kernel code that runs in a infinite loop
 //obviously pretty simple but important to know how it works 
-void kernel_main() {
+void kernel_main(uint32_t mb_magic, struct multiboot_info* mb_info) {
+    //per cpu segments first, interrupt handlers use this_cpu()
+    smp_early_init();
+
+    //grub's memory map, read before anything (the ap trampoline) can overwrite low memory
+    pmm_init(mb_magic, mb_info);
+    //the file data region is fixed, keep it from the page allocator before anything allocates
+    pmm_reserve(FS_START_ADDR, FS_REGION_SIZE);
+    slab_init();
+
     //starts timer
     hpet_init();
 
+    //interrupts, the apic timer (or hpet/pit) drives the timer wheel so sleeping doesn't spin
+    idt_install();
+    isrs_install();
+    //identity map with 4MB pages, after isrs_install so the page fault handler sticks
+    paging_init();
+    irq_install();
+    workq_init();
+    serial_init();
+    serial_enable_irq();
+    timer_subsystem_init();
+    keyboard_init();
+    __asm__ volatile("sti");
+
+    //wakes the other cores, this needs the timer for the INIT/SIPI delays
+    jobs_init();
+    smp_init();
+
+    //from here on kernel_main is the shell thread and bg can start more
+    threads_init();
+
     clear_screen();
     //puts our splash screen
     splash_screen();
 
     //adds our preset files and users
     user_init();
+    //the disk first, fs_init loads from it when it has a filesystem
+    ata_init();
     fs_init();
     file_t* welcome = find_file("welcome.txt");
-    if(welcome && welcome->data)
-        for(uint32_t i=0;i<welcome->size;i++) putchar((char)welcome->data[i]);
+    uint32_t len;
+    const uint8_t* p;
+    for(uint32_t i=0; welcome && (p = fs_extent(welcome, i, &len)); i++)
+        for(uint32_t j=0;j<len;j++) putchar((char)p[j]);
 
     buffer_index=0; input_buffer[0]=0;
 
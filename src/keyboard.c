@@ -0,0 +1,170 @@
+#include "../include/common.h"
+#include "../include/keyboard.h"
+#include "../include/interrupts.h"
+#include "../include/smp.h"
+#include "../include/thread.h"
+#include "../include/trace.h"
+#include "../include/workq.h"
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+#define KBD_DATA   0x60
+#define KBD_STATUS 0x64
+#define KBD_IRQ    1
+
+//keyboard system: irq1 only reads the scancode and hands it to a bottom half, which
+//decodes it and queues finished keys. getkey takes them off that queue and blocks while it is empty
+static int shift_pressed = 0;
+
+static const char keymap_normal[128] = {
+    0,  27,'1','2','3','4','5','6','7','8','9','0','-','=', '\b',
+    '\t','q','w','e','r','t','y','u','i','o','p','[',']','\n',0,
+    'a','s','d','f','g','h','j','k','l',';','\'','`',0,'\\','z',
+    'x','c','v','b','n','m',',','.','/',0,'*',
+    0,0,0,0,0,0,0,' ',0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+
+static const char keymap_shift[128] = {
+    0,  27,'!','@','#','$','%','^','&','*','(',')','_','+', '\b',
+    '\t','Q','W','E','R','T','Y','U','I','O','P','{','}','\n',0,
+    'A','S','D','F','G','H','J','K','L',':','"','~',0,'|','Z',
+    'X','C','V','B','N','M','<','>','?','*',
+    0,0,0,0,0,0,0,' ',0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+
+//single producer (the bottom half) single consumer (getkey) ring. each side only writes its own
+//index, so there is no lock, just ordering between the slot and the index
+#define KBD_RING_SIZE 256 //power of two
+#define KBD_RING_MASK (KBD_RING_SIZE - 1)
+
+static uint16_t kbd_ring[KBD_RING_SIZE];
+static volatile uint32_t kbd_head = 0; //next slot the bottom half fills
+static volatile uint32_t kbd_tail = 0; //next slot getkey reads
+static struct thread* kbd_waiter = 0;    //thread blocked in getkey, the bottom half wakes it
+static uint32_t kbd_dropped = 0;
+
+//raw scancodes from the irq to the bottom half, same single producer single consumer idea
+#define SC_RING_SIZE 64
+#define SC_RING_MASK (SC_RING_SIZE - 1)
+static uint8_t sc_ring[SC_RING_SIZE];
+static volatile uint32_t sc_head = 0;
+static volatile uint32_t sc_tail = 0;
+static struct work kbd_work;
+
+//turns one scancode into a key, 0 if it only changed state (shift, prefix, release)
+static int decode(uint8_t sc) {
+    static int e0_prefix = 0;
+
+    if (sc == 0xE0) {
+        e0_prefix = 1;
+        return 0;
+    }
+
+    // Key release
+    if (sc & 0x80) {
+        sc &= 0x7F;
+        if (sc == 42 || sc == 54) shift_pressed = 0;
+        e0_prefix = 0;
+        return 0;
+    }
+
+    // Handle shift press
+    if (sc == 42 || sc == 54) {
+        shift_pressed = 1;
+        e0_prefix = 0;
+        return 0;
+    }
+
+    if (e0_prefix) {
+        e0_prefix = 0;
+        switch (sc) {
+            case 0x48: return KEY_UP;
+            case 0x50: return KEY_DOWN;
+            case 0x4B: return KEY_LEFT;
+            case 0x4D: return KEY_RIGHT;
+            default: return 0;
+        }
+    }
+
+    // Regular spacebar
+    if (sc == 57) return ' ';
+
+    // Normal keys
+    return shift_pressed ? keymap_shift[sc] : keymap_normal[sc];
+}
+
+//bottom half, decodes everything the irq has collected since the last run
+static void kbd_decode_work(void* arg) {
+    (void)arg;
+    int queued = 0;
+    while (sc_tail != __atomic_load_n(&sc_head, __ATOMIC_ACQUIRE)) {
+        uint8_t sc = sc_ring[sc_tail & SC_RING_MASK];
+        __atomic_store_n(&sc_tail, sc_tail + 1, __ATOMIC_RELEASE);
+
+        int key = decode(sc);
+        if (!key) continue;
+        uint32_t head = kbd_head;
+        if (head - __atomic_load_n(&kbd_tail, __ATOMIC_ACQUIRE) >= KBD_RING_SIZE) {
+            kbd_dropped++;
+            continue;
+        }
+        kbd_ring[head & KBD_RING_MASK] = (uint16_t)key;
+        __atomic_store_n(&kbd_head, head + 1, __ATOMIC_RELEASE);
+        queued = 1;
+    }
+    if (queued && kbd_waiter) thread_wake(kbd_waiter);
+}
+
+static void keyboard_irq(struct regs* r, void* ctx) {
+    (void)r;
+    (void)ctx;
+    uint8_t sc = inb(KBD_DATA); //has to be read to ack the controller, everything else can wait
+    uint32_t head = sc_head;
+    if (head - sc_tail >= SC_RING_SIZE) {
+        kbd_dropped++;
+        return;
+    }
+    sc_ring[head & SC_RING_MASK] = sc;
+    __atomic_store_n(&sc_head, head + 1, __ATOMIC_RELEASE);
+    work_queue(&kbd_work);
+}
+
+void keyboard_init(void) {
+    //throw away anything the bios or grub left in the controller
+    while (inb(KBD_STATUS) & 1) inb(KBD_DATA);
+    work_setup(&kbd_work, kbd_decode_work, 0);
+    irq_register(KBD_IRQ, keyboard_irq, 0);
+}
+
+int getkey_nowait(void) {
+    uint32_t tail = kbd_tail;
+    if (tail == __atomic_load_n(&kbd_head, __ATOMIC_ACQUIRE)) return -1;
+    int key = kbd_ring[tail & KBD_RING_MASK];
+    __atomic_store_n(&kbd_tail, tail + 1, __ATOMIC_RELEASE);
+    TRACE(TRACE_GETKEY, key, 0);
+    return key;
+}
+
+int getkey(void) {
+    while (1) {
+        int key = getkey_nowait();
+        if (key >= 0) return key;
+
+        //interrupts stay off from the check until we block (or cpu_idle's sti; hlt), so the irq can't land in between
+        __asm__ volatile ("cli");
+        if (kbd_tail != kbd_head) { __asm__ volatile ("sti"); continue; }
+        struct thread* self = this_cpu()->current;
+        if (self) {
+            kbd_waiter = self;
+            thread_block();
+            kbd_waiter = 0;
+            __asm__ volatile ("sti");
+        } else {
+            cpu_idle();
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#include "../include/common.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/console.h"
+#include "../include/interrupts.h"
+#include "../include/ksyms.h"
+
+#define PAT_MSR      0x277
+#define PAT_WC       0x01
+#define VGA_TEXT     0xB8000
+#define VGA_TEXT_END 0xC0000
+//entry.S starts the boot cpu (and so the shell) at 0x90000, this leaves it 64k
+#define BOOT_STACK_GUARD 0x7F000
+#define MAX_GUARDS   48 //boot stack, a thread stack per slot, an ap stack per cpu
+
+static uint32_t page_dir[1024] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t low_table[1024] __attribute__((aligned(PAGE_SIZE))); //the first 4MB in 4k pages
+static int enabled = 0;
+static int have_pat = 0;
+static uint32_t wb_chunks = 0, uc_chunks = 0;
+
+static struct {
+    uint32_t addr;
+    const char* what;
+} guards[MAX_GUARDS];
+static uint32_t guard_count = 0;
+
+//pat entry 1 (pwt set, pcd clear) goes from write through to write combining. entry 0 stays
+//write back and 3 (pwt|pcd) uncached, so those bits keep meaning what they always did
+static void pat_init(void) {
+    uint64_t pat = rdmsr(PAT_MSR);
+    pat = (pat & ~(0xFFULL << 8)) | ((uint64_t)PAT_WC << 8);
+    __asm__ volatile ("wbinvd" : : : "memory");
+    wrmsr(PAT_MSR, pat);
+}
+
+static void paging_enable(void) {
+    uint32_t r;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(r));
+    r |= 0x10; //pse
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(r));
+    __asm__ volatile ("mov %0, %%cr3" : : "r"((uint32_t)page_dir) : "memory");
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(r));
+    r |= 0x80010000; //pg, and wp so read only pages hold against the kernel too
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(r) : "memory");
+}
+
+static void page_fault(struct regs* r, void* ctx) {
+    (void)ctx;
+    uint32_t addr;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(addr));
+    puts("\nPAGE FAULT ");
+    puts(r->err_code & 2 ? "writing " : "reading ");
+    print_hex(addr);
+    puts(r->err_code & 1 ? " (read only)" : " (not mapped)");
+
+    const char* g = paging_guard_name(addr);
+    if (g) { puts("\n  guard page under the "); puts(g); puts(", stack overflow"); }
+    else if (addr < PAGE_SIZE) puts("\n  null pointer");
+
+    puts("\n  eip ");
+    print_hex(r->eip);
+    int sym = ksym_lookup(r->eip);
+    if (sym >= 0) { puts(" ("); puts(ksyms[sym].name); puts(")"); }
+    puts("\nsystem halted\n");
+    while (1) __asm__ volatile ("cli; hlt");
+}
+
+void paging_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & (1 << 3))) return; //no pse, stay unpaged rather than spend a page table per 4MB
+    have_pat = (d >> 16) & 1;
+
+    for (uint32_t i = 0; i < 1024; i++) low_table[i] = (i << PAGE_SHIFT) | PDE_PRESENT | PDE_WRITE;
+    //the bios data area is in here (acpi reads the ebda pointer from it) so it can't go
+    //away completely, read only still catches writes through a null pointer
+    low_table[0] = PDE_PRESENT;
+    //clear_screen and scrolling write the whole buffer a word at a time, combining them
+    //into bursts is most of the cost gone. without pat the best we can do is uncached
+    for (uint32_t p = VGA_TEXT; p < VGA_TEXT_END; p += PAGE_SIZE)
+        low_table[p >> PAGE_SHIFT] |= have_pat ? PDE_PWT : PDE_PCD | PDE_PWT;
+    page_dir[0] = (uint32_t)low_table | PDE_PRESENT | PDE_WRITE;
+
+    //the kernel, the filesystem at 0x400000 and every page the pmm hands out are in the
+    //write back part, one tlb entry per 4MB. the mtrrs still win over write back for
+    //anything the firmware marked uncached
+    uint32_t ram_chunks = (pmm_top_frame() + 1023) / 1024;
+    for (uint32_t i = 1; i < 1024; i++) {
+        uint32_t e = (i << 22) | PDE_PRESENT | PDE_WRITE | PDE_PS;
+        if (i < ram_chunks) wb_chunks++;
+        else { e |= PDE_PCD | PDE_PWT; uc_chunks++; }
+        page_dir[i] = e;
+    }
+
+    paging_guard(BOOT_STACK_GUARD, "boot stack");
+
+    if (have_pat) pat_init();
+    paging_enable();
+    enabled = 1;
+    interrupt_register(14, page_fault, 0);
+}
+
+void paging_ap_init(void) {
+    if (!enabled) return;
+    if (have_pat) pat_init();
+    paging_enable();
+}
+
+int paging_enabled(void) {
+    return enabled;
+}
+
+uint32_t paging_directory(void) {
+    return (uint32_t)page_dir;
+}
+
+int paging_guard(uint32_t addr, const char* what) {
+    addr &= ~(PAGE_SIZE - 1);
+    if (addr >= PAGE_LARGE) return -1;
+    uint32_t flags = irq_save();
+    if (guard_count == MAX_GUARDS) { irq_restore(flags); return -1; }
+    guards[guard_count].addr = addr;
+    guards[guard_count].what = what;
+    guard_count++;
+    low_table[addr >> PAGE_SHIFT] &= ~PDE_PRESENT;
+    if (enabled) __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+    irq_restore(flags);
+    return 0;
+}
+
+const char* paging_guard_name(uint32_t addr) {
+    addr &= ~(PAGE_SIZE - 1);
+    for (uint32_t i = 0; i < guard_count; i++)
+        if (guards[i].addr == addr) return guards[i].what;
+    return 0;
+}
+
+void paging_print(void) {
+    if (!enabled) { puts("paging: off, no pse\n"); return; }
+    puts("paging: ");
+    print_uint(wb_chunks * 4 + 4);
+    puts(" MB write back, ");
+    print_uint(uc_chunks * 4);
+    puts(" MB uncached in 4MB pages, vga ");
+    puts(have_pat ? "write combining, " : "uncached, ");
+    print_uint(guard_count);
+    puts(" guard pages\n");
+}
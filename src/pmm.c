@@ -0,0 +1,153 @@
+#include "../include/common.h"
+#include "../include/pmm.h"
+#include "../include/spinlock.h"
+#include "../include/console.h"
+
+//bitmap frame allocator, a set bit is a used (or nonexistent) frame. allocation scans
+//from a hint a word at a time, so a fully used stretch costs one compare per 32 frames
+#define MAX_FRAMES  (1u << 20) //4GB worth, all a 32 bit kernel without pae can reach
+#define LOW_MEMORY  0x100000   //bios data, the ap trampoline, the boot stack and vga all live down here
+
+extern char _kernel_start[], _kernel_end[]; //linker.ld
+
+static uint32_t frame_bitmap[MAX_FRAMES / 32];
+static uint32_t max_frame = 0;     //one past the highest frame the memory map mentions as usable
+static uint32_t total_pages = 0;   //usable pages, whether in use or not
+static uint32_t free_pages = 0;
+static uint32_t next_word = 0;     //where the next search starts
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+static inline int frame_used(uint32_t f) {
+    return (frame_bitmap[f >> 5] >> (f & 31)) & 1;
+}
+
+static void frame_set(uint32_t f) {
+    if (frame_used(f)) return;
+    frame_bitmap[f >> 5] |= 1u << (f & 31);
+    free_pages--;
+}
+
+static void frame_clear(uint32_t f) {
+    if (!frame_used(f)) return;
+    frame_bitmap[f >> 5] &= ~(1u << (f & 31));
+    free_pages++;
+}
+
+//frees every whole page inside [addr, addr + len), anything above 4GB is out of reach
+static void region_free(uint64_t addr, uint64_t len) {
+    uint64_t end = addr + len;
+    if (end > 0x100000000ULL) end = 0x100000000ULL;
+    uint64_t first = (addr + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint64_t last = end >> PAGE_SHIFT;
+    for (uint64_t f = first; f < last; f++) {
+        if (frame_used((uint32_t)f)) total_pages++;
+        frame_clear((uint32_t)f);
+    }
+    //a region wholly above 4GB clamps to nothing, it mustn't drag max_frame up to 4GB
+    if (first < last && last > max_frame) max_frame = (uint32_t)last;
+}
+
+//marks every page touching [addr, addr + len) as used
+void pmm_reserve(uint32_t addr, uint32_t len) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t first = addr >> PAGE_SHIFT;
+    uint32_t last = (uint32_t)(((uint64_t)addr + len + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    for (uint32_t f = first; f < last && f < MAX_FRAMES; f++) frame_set(f);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void pmm_init(uint32_t magic, struct multiboot_info* mbi) {
+    for (uint32_t i = 0; i < MAX_FRAMES / 32; i++) frame_bitmap[i] = ~0u;
+
+    if (magic == MULTIBOOT_MAGIC && (mbi->flags & MB_INFO_MMAP)) {
+        uint32_t p = mbi->mmap_addr;
+        uint32_t end = mbi->mmap_addr + mbi->mmap_length;
+        while (p < end) {
+            struct multiboot_mmap_entry* e = (struct multiboot_mmap_entry*)p;
+            if (e->type == MB_MMAP_AVAILABLE) region_free(e->addr, e->len);
+            p += e->size + 4;
+        }
+    } else if (magic == MULTIBOOT_MAGIC && (mbi->flags & MB_INFO_MEM)) {
+        //no map, just the size of the first stretch above 1MB
+        region_free(LOW_MEMORY, (uint64_t)mbi->mem_upper * 1024);
+    } else {
+        //not booted by a multiboot loader, assume the 16MB the filesystem always has
+        region_free(LOW_MEMORY, 15 * 0x100000);
+    }
+
+    pmm_reserve(0, LOW_MEMORY);
+    pmm_reserve((uint32_t)_kernel_start, (uint32_t)(_kernel_end - _kernel_start));
+}
+
+uint32_t pmm_alloc(void) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t words = (max_frame + 31) / 32;
+    for (uint32_t n = 0; n < words; n++) {
+        uint32_t w = (next_word + n) % words;
+        if (frame_bitmap[w] == ~0u) continue;
+
+        uint32_t bit = __builtin_ctz(~frame_bitmap[w]);
+        uint32_t f = w * 32 + bit;
+        frame_set(f);
+        next_word = w;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return f << PAGE_SHIFT;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
+}
+
+void pmm_free(uint32_t addr) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t f = addr >> PAGE_SHIFT;
+    frame_clear(f);
+    if ((f >> 5) < next_word) next_word = f >> 5; //low frames get handed out again first
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+//first fit, frame by frame. only the arena asks for runs and it keeps what it gets, so this is rare
+uint32_t pmm_alloc_run(uint32_t count) {
+    if (count <= 1) return count ? pmm_alloc() : 0;
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t run = 0;
+    for (uint32_t f = 0; f < max_frame; f++) {
+        if (frame_used(f)) { run = 0; continue; }
+        if (++run < count) continue;
+        uint32_t first = f + 1 - count;
+        for (uint32_t i = first; i <= f; i++) frame_set(i);
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return first << PAGE_SHIFT;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
+}
+
+void pmm_free_run(uint32_t addr, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) pmm_free(addr + i * PAGE_SIZE);
+}
+
+uint32_t pmm_total_pages(void) {
+    return total_pages;
+}
+
+uint32_t pmm_free_pages(void) {
+    return free_pages;
+}
+
+uint32_t pmm_top_frame(void) {
+    return max_frame;
+}
+
+void pmm_print(void) {
+    uint32_t total_kb = total_pages * (PAGE_SIZE / 1024);
+    uint32_t free_kb = free_pages * (PAGE_SIZE / 1024);
+    puts("memory: ");
+    print_uint(total_kb / 1024);
+    puts(" MB usable, ");
+    print_uint((total_kb - free_kb) / 1024);
+    puts(" MB used, ");
+    print_uint(free_kb / 1024);
+    puts(" MB free (");
+    print_uint(free_pages);
+    puts(" free pages)\n");
+}
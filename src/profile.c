@@ -0,0 +1,211 @@
+#include "../include/common.h"
+#include "../include/console.h"
+#include "../include/profile.h"
+#include "../include/ksyms.h"
+#include "../include/timer.h"
+#include "../include/interrupts.h"
+#include "../include/serial.h"
+
+
+extern char _etext[]; //end of kernel text, from linker.ld
+
+//every sample lands in the bucket of the function it hit, so a sample is a binary search and an increment
+#define PROF_MAX_SYMS 2048
+#define PROF_PERIOD_US 1000 //1kHz sampling
+
+//call graph mode also keeps whole stacks, folded the way flamegraph.pl wants them.
+//a stack is stored as symbol indices (root first) so every sample in the same call path shares an entry
+#define PROF_MAX_DEPTH  24
+#define PROF_MAX_STACKS 512 //power of two, open addressed by hash
+#define PROF_NO_SYM     0xFFFF
+#define PROF_STACK_SPAN 0x10000 //how far above the interrupted esp we believe frame pointers
+
+struct prof_stack {
+    uint32_t hash;
+    uint32_t count;
+    uint16_t depth;
+    uint16_t syms[PROF_MAX_DEPTH];
+};
+
+volatile int profile_enabled = 0;
+static int prof_callgraph = 0;
+static struct prof_stack prof_stacks[PROF_MAX_STACKS];
+static uint32_t prof_stacks_dropped = 0;
+static uint32_t prof_hits[PROF_MAX_SYMS];
+static uint32_t prof_other = 0;  //samples outside kernel text (or past the table)
+static uint32_t prof_total = 0;
+static struct timer prof_timer;
+
+int ksym_lookup(uint32_t addr) {
+    if (ksym_count == 0 || addr < ksyms[0].addr || addr >= (uint32_t)_etext) return -1;
+
+    int lo = 0, hi = ksym_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (ksyms[mid].addr <= addr) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+static uint16_t sym_id(uint32_t addr) {
+    int idx = ksym_lookup(addr);
+    return idx < 0 ? PROF_NO_SYM : (uint16_t)idx;
+}
+
+//walks the saved ebp chain from the interrupted frame: [ebp] is the caller's ebp, [ebp+4] the return address.
+//the interrupted code didn't change privilege, so its esp is right where the cpu stopped pushing (useresp)
+static void record_stack(struct regs* r, int leaf) {
+    uint16_t leaf_first[PROF_MAX_DEPTH];
+    int depth = 0;
+    leaf_first[depth++] = (uint16_t)leaf;
+
+    uint32_t lo = (uint32_t)&r->useresp;
+    uint32_t ebp = r->ebp;
+    while (depth < PROF_MAX_DEPTH && ebp >= lo && ebp < lo + PROF_STACK_SPAN && !(ebp & 3)) {
+        uint32_t* frame = (uint32_t*)ebp;
+        uint32_t ret = frame[1];
+        if (ret == 0) break;
+        leaf_first[depth++] = sym_id(ret - 1); //ret points past the call, which may be the next function
+        if (frame[0] <= ebp) break;          //frames only go up the stack
+        ebp = frame[0];
+    }
+
+    //fnv-1a over the indices, root first
+    uint16_t syms[PROF_MAX_DEPTH];
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        syms[i] = leaf_first[depth - 1 - i];
+        hash = (hash ^ syms[i]) * 16777619u;
+    }
+
+    for (uint32_t probe = 0; probe < PROF_MAX_STACKS; probe++) {
+        struct prof_stack* st = &prof_stacks[(hash + probe) & (PROF_MAX_STACKS - 1)];
+        if (st->count == 0) {
+            st->hash = hash;
+            st->depth = depth;
+            for (int i = 0; i < depth; i++) st->syms[i] = syms[i];
+            st->count = 1;
+            return;
+        }
+        if (st->hash != hash || st->depth != depth) continue;
+        int same = 1;
+        for (int i = 0; i < depth && same; i++) same = st->syms[i] == syms[i];
+        if (same) { st->count++; return; }
+    }
+    prof_stacks_dropped++;
+}
+
+void profile_sample(struct regs* r) {
+    if (!profile_enabled) return;
+    int idx = ksym_lookup(r->eip);
+    if (idx >= 0 && idx < PROF_MAX_SYMS) prof_hits[idx]++;
+    else prof_other++;
+    prof_total++;
+
+    if (prof_callgraph) record_stack(r, idx < 0 ? PROF_NO_SYM : idx);
+}
+
+//the wheel is tickless, so while we profile keep a timer going to make sure irq0 keeps firing
+static void prof_tick(void* arg) {
+    (void)arg;
+    if (profile_enabled) timer_add_us(&prof_timer, PROF_PERIOD_US);
+}
+
+void profile_start(int callgraph) {
+    prof_callgraph = callgraph;
+    profile_enabled = 1;
+    timer_setup(&prof_timer, prof_tick, 0);
+    timer_add_us(&prof_timer, PROF_PERIOD_US);
+}
+
+void profile_stop(void) {
+    profile_enabled = 0;
+    timer_del(&prof_timer);
+}
+
+void profile_reset(void) {
+    for (int i = 0; i < PROF_MAX_SYMS; i++) prof_hits[i] = 0;
+    prof_other = 0;
+    prof_total = 0;
+    for (int i = 0; i < PROF_MAX_STACKS; i++) prof_stacks[i].count = 0;
+    prof_stacks_dropped = 0;
+}
+
+//percent with one decimal
+static void print_percent(uint32_t part, uint32_t total) {
+    uint32_t tenths = (uint32_t)div64_u32((uint64_t)part * 1000, total, 0);
+    print_uint(tenths / 10);
+    putchar('.');
+    print_uint(tenths % 10);
+    putchar('%');
+}
+
+//prints the hottest functions, like perf top
+void profile_report(int top) {
+    uint32_t total = prof_total;
+    if (total == 0) { puts("no samples\n"); return; }
+
+    puts("samples: ");
+    print_uint(total);
+    puts("\n");
+
+    uint32_t limit = ksym_count < PROF_MAX_SYMS ? ksym_count : PROF_MAX_SYMS;
+    uint32_t shown_below = 0xFFFFFFFF; //count of the last symbol printed
+    int shown_idx = -1;
+    for (int n = 0; n < top; n++) {
+        //next biggest bucket, ties go in symbol order
+        int best = -1;
+        for (uint32_t i = 0; i < limit; i++) {
+            uint32_t c = prof_hits[i];
+            if (c == 0 || c > shown_below || (c == shown_below && (int)i <= shown_idx)) continue;
+            if (best < 0 || c > prof_hits[best]) best = i;
+        }
+        if (best < 0) break;
+        shown_below = prof_hits[best];
+        shown_idx = best;
+
+        puts("  ");
+        print_percent(prof_hits[best], total);
+        puts("  ");
+        print_uint(prof_hits[best]);
+        puts("  ");
+        puts(ksyms[best].name);
+        puts("\n");
+    }
+    if (prof_other) {
+        puts("  ");
+        print_percent(prof_other, total);
+        puts("  ");
+        print_uint(prof_other);
+        puts("  [unknown]\n");
+    }
+}
+
+//streams the call graph samples out COM1 as folded stacks, one "a;b;c count" line per call path.
+//on the host: qemu ... -serial file:perf.folded, then flamegraph.pl perf.folded > perf.svg
+void profile_dump_folded(void) {
+    uint32_t lines = 0;
+    for (int i = 0; i < PROF_MAX_STACKS; i++) {
+        struct prof_stack* st = &prof_stacks[i];
+        if (st->count == 0) continue;
+        for (int d = 0; d < st->depth; d++) {
+            if (d) serial_putc(';');
+            serial_write(st->syms[d] == PROF_NO_SYM ? "[unknown]" : ksyms[st->syms[d]].name);
+        }
+        serial_putc(' ');
+        serial_write_uint(st->count);
+        serial_putc('\n');
+        lines++;
+    }
+
+    puts("wrote ");
+    print_uint(lines);
+    puts(" stacks to COM1");
+    if (prof_stacks_dropped) {
+        puts(" (");
+        print_uint(prof_stacks_dropped);
+        puts(" samples didn't fit)");
+    }
+    puts("\n");
+}
@@ -0,0 +1,131 @@
+#include "../include/common.h"
+#include "../include/serial.h"
+#include "../include/interrupts.h"
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+//16550 uart registers, offsets from the base port
+#define COM1        0x3F8
+#define COM1_IRQ    4
+#define UART_DATA   0 //THR on write, RBR on read, divisor low when DLAB is set
+#define UART_IER    1 //divisor high when DLAB is set
+#define UART_IIR    2 //on read
+#define UART_FCR    2 //on write
+#define UART_LCR    3
+#define UART_MCR    4
+#define UART_LSR    5
+
+#define IER_THRE      0x02 //interrupt when the transmit holding register/fifo empties
+#define IIR_NO_INT    0x01
+#define IIR_ID_MASK   0x0E
+#define IIR_THRE      0x02
+#define LSR_THR_EMPTY 0x20
+#define UART_FIFO     16   //bytes we can hand the 16550 at once after a THRE
+
+//output is queued in a ring and the THRE interrupt drains it a fifo load at a time,
+//so writers only pay for copying bytes in, not for waiting on the wire
+#define TX_SIZE 4096 //power of two
+#define TX_MASK (TX_SIZE - 1)
+
+static char tx_ring[TX_SIZE];
+static volatile uint32_t tx_head = 0; //written by serial_putc
+static volatile uint32_t tx_tail = 0; //written by whoever feeds the uart
+static int serial_ready = 0;
+static int tx_irq = 0;    //THRE interrupt is wired up
+static int tx_busy = 0;   //a THRE interrupt is expected, so don't feed the uart directly
+
+//moves up to a fifo load into the uart, must run with interrupts off
+static void tx_fill(void) {
+    int n = 0;
+    while (tx_tail != tx_head && n < UART_FIFO) {
+        outb(COM1 + UART_DATA, (uint8_t)tx_ring[tx_tail & TX_MASK]);
+        tx_tail++;
+        n++;
+    }
+    tx_busy = n > 0;
+    if (tx_irq) outb(COM1 + UART_IER, tx_busy ? IER_THRE : 0x00);
+}
+
+void serial_init(void) {
+    outb(COM1 + UART_IER, 0x00);  //no interrupts while we set it up
+    outb(COM1 + UART_LCR, 0x80);  //DLAB on to set the baud divisor
+    outb(COM1 + UART_DATA, 0x01); //115200 baud
+    outb(COM1 + UART_IER, 0x00);
+    outb(COM1 + UART_LCR, 0x03);  //8N1, DLAB off
+    outb(COM1 + UART_FCR, 0xC7);  //fifos on and cleared, 14 byte threshold
+    outb(COM1 + UART_MCR, 0x0B);  //DTR, RTS, OUT2 (OUT2 gates the irq line)
+    serial_ready = 1;
+}
+
+//switches from polling to the THRE interrupt, call once the idt and pic are set up
+void serial_enable_irq(void) {
+    uint32_t flags = irq_save();
+    tx_irq = 1;
+    irq_register(COM1_IRQ, serial_irq, 0);
+    if (!tx_busy && (inb(COM1 + UART_LSR) & LSR_THR_EMPTY)) tx_fill();
+    irq_restore(flags);
+}
+
+void serial_irq(struct regs* r, void* ctx) {
+    (void)r;
+    (void)ctx;
+    //only THRE is enabled, but look a few times in case more than one cause is latched
+    for (int i = 0; i < 4; i++) {
+        uint8_t iir = inb(COM1 + UART_IIR);
+        if (iir & IIR_NO_INT) break;
+        if ((iir & IIR_ID_MASK) == IIR_THRE) tx_fill();
+        else inb(COM1 + UART_LSR); //line status, reading it clears it
+    }
+}
+
+void serial_putc(char c) {
+    if (!serial_ready) return;
+    if (c == '\n') serial_putc('\r');
+
+    uint32_t flags = irq_save();
+    while (tx_head - tx_tail >= TX_SIZE) {
+        //ring is full, push a fifo load out by hand rather than dropping output
+        while (!(inb(COM1 + UART_LSR) & LSR_THR_EMPTY));
+        tx_fill();
+    }
+    tx_ring[tx_head & TX_MASK] = c;
+    tx_head++;
+
+    //idle transmitter, start it. after that the THRE interrupt keeps it going
+    if (!tx_busy || !tx_irq) {
+        if (inb(COM1 + UART_LSR) & LSR_THR_EMPTY) tx_fill();
+    }
+    irq_restore(flags);
+}
+
+void serial_write(const char* s) {
+    while (*s) serial_putc(*s++);
+}
+
+void serial_write_uint(uint32_t num) {
+    char buf[11];
+    int i = 10;
+    buf[i] = '\0';
+    if (num == 0) { serial_putc('0'); return; }
+    while (num > 0 && i > 0) {
+        buf[--i] = '0' + (num % 10);
+        num /= 10;
+    }
+    serial_write(&buf[i]);
+}
+
+//waits until everything queued has been handed to the uart
+void serial_flush(void) {
+    while (tx_head != tx_tail) {
+        uint32_t flags = irq_save();
+        if (inb(COM1 + UART_LSR) & LSR_THR_EMPTY) tx_fill();
+        irq_restore(flags);
+    }
+}
@@ -0,0 +1,190 @@
+#include "../include/common.h"
+#include "../include/slab.h"
+#include "../include/pmm.h"
+#include "../include/console.h"
+#include "../include/string.h"
+
+struct slab {
+    struct slab* next;
+    struct slab* prev;
+    struct kmem_cache* cache;
+    void* freelist;
+    uint32_t in_use;
+};
+
+//a slab is page aligned, so any object pointer finds its header by masking
+#define SLAB_OF(p) ((struct slab*)((uint32_t)(p) & ~(PAGE_SIZE - 1)))
+#define LINK(c, obj) (*(void**)((uint8_t*)(obj) + (c)->link))
+
+//the caches themselves come out of a cache, this one is set up by hand
+static struct kmem_cache cache_cache;
+static struct kmem_cache* caches = 0;
+static spinlock_t caches_lock = SPINLOCK_INIT;
+
+#define KMALLOC_CLASSES 8 //16, 32, ... 1024, KMALLOC_MAX
+static struct kmem_cache* kmalloc_caches[KMALLOC_CLASSES];
+static const char* kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2032",
+};
+
+static void slab_list_add(struct slab** head, struct slab* s) {
+    s->prev = 0;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void slab_list_del(struct slab** head, struct slab* s) {
+    if (s->prev) s->prev->next = s->next;
+    else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = 0;
+}
+
+//-1 (and not on the cache list) when fewer than two objects fit in a page next to the header
+static int cache_setup(struct kmem_cache* c, const char* name, uint32_t size, uint32_t flags, void (*ctor)(void*)) {
+    uint32_t align = (flags & SLAB_HWCACHE_ALIGN) ? CACHE_LINE : sizeof(void*);
+    c->name = name;
+    c->size = size;
+    //free objects are chained through a word inside them. with a constructor that word
+    //goes after the object so a freed object keeps everything the constructor set up
+    c->link = ctor ? (size + 3) & ~3u : 0;
+    uint32_t span = ctor ? c->link + sizeof(void*) : size;
+    if (span < sizeof(void*)) span = sizeof(void*);
+    c->stride = (span + align - 1) & ~(align - 1);
+    c->first = (sizeof(struct slab) + align - 1) & ~(align - 1);
+    c->per_slab = (PAGE_SIZE - c->first) / c->stride;
+    if (c->per_slab < 2) return -1; //a page per object, kmalloc from the page allocator would do as well
+    c->ctor = ctor;
+    c->partial = c->full = c->empty = 0;
+    c->slabs = c->in_use = c->allocs = 0;
+    c->lock.locked = 0;
+
+    uint32_t f = spin_lock_irqsave(&caches_lock);
+    c->next = caches;
+    caches = c;
+    spin_unlock_irqrestore(&caches_lock, f);
+    return 0;
+}
+
+//carves a fresh page into objects, newest objects end up at the front of the freelist
+static struct slab* slab_grow(struct kmem_cache* c) {
+    uint32_t page = pmm_alloc();
+    if (!page) return 0;
+
+    struct slab* s = (struct slab*)page;
+    s->cache = c;
+    s->in_use = 0;
+    s->freelist = 0;
+    for (int i = c->per_slab - 1; i >= 0; i--) {
+        void* obj = (void*)(page + c->first + i * c->stride);
+        if (c->ctor) c->ctor(obj);
+        LINK(c, obj) = s->freelist;
+        s->freelist = obj;
+    }
+    c->slabs++;
+    return s;
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size, uint32_t flags, void (*ctor)(void*)) {
+    if (size > PAGE_SIZE / 2) return 0;
+
+    struct kmem_cache* c = kmem_cache_alloc(&cache_cache);
+    if (!c) return 0;
+    if (cache_setup(c, name, size, flags, ctor) < 0) {
+        kmem_cache_free(&cache_cache, c);
+        return 0;
+    }
+    return c;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* c) {
+    uint32_t flags = spin_lock_irqsave(&c->lock);
+    struct slab* s = c->partial;
+    if (!s) {
+        s = c->empty;
+        if (s) c->empty = 0;
+        else s = slab_grow(c);
+        if (!s) { spin_unlock_irqrestore(&c->lock, flags); return 0; }
+        slab_list_add(&c->partial, s);
+    }
+
+    void* obj = s->freelist;
+    s->freelist = LINK(c, obj);
+    s->in_use++;
+    if (s->in_use == c->per_slab) {
+        slab_list_del(&c->partial, s);
+        slab_list_add(&c->full, s);
+    }
+    c->in_use++;
+    c->allocs++;
+    spin_unlock_irqrestore(&c->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache* c, void* obj) {
+    if (!obj) return;
+    struct slab* s = SLAB_OF(obj);
+    uint32_t flags = spin_lock_irqsave(&c->lock);
+
+    if (s->in_use == c->per_slab) {
+        slab_list_del(&c->full, s);
+        slab_list_add(&c->partial, s);
+    }
+    LINK(c, obj) = s->freelist;
+    s->freelist = obj;
+    s->in_use--;
+    c->in_use--;
+
+    uint32_t page = 0;
+    if (s->in_use == 0) {
+        slab_list_del(&c->partial, s);
+        //keep one empty slab so a cache bouncing around a page boundary doesn't thrash the page allocator
+        if (!c->empty) {
+            c->empty = s;
+        } else {
+            page = (uint32_t)s;
+            c->slabs--;
+        }
+    }
+    spin_unlock_irqrestore(&c->lock, flags);
+    if (page) pmm_free(page);
+}
+
+void slab_init(void) {
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, 0);
+    for (int i = 0; i < KMALLOC_CLASSES; i++)
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], i == KMALLOC_CLASSES - 1 ? KMALLOC_MAX : 16u << i, 0, 0);
+}
+
+void* kmalloc(uint32_t size) {
+    if (size > KMALLOC_MAX) return 0;
+    int cls = 0;
+    while (cls < KMALLOC_CLASSES - 1 && (16u << cls) < size) cls++;
+    return kmem_cache_alloc(kmalloc_caches[cls]);
+}
+
+void kfree(void* p) {
+    if (!p) return;
+    kmem_cache_free(SLAB_OF(p)->cache, p);
+}
+
+char* kstrdup(const char* s) {
+    uint32_t len = strlen(s) + 1;
+    char* d = kmalloc(len);
+    if (d) memcpy(d, s, len);
+    return d;
+}
+
+void slab_print_stats(void) {
+    puts("cache            objsize  in use   slabs   allocs\n");
+    for (struct kmem_cache* c = caches; c; c = c->next) {
+        int len = strlen(c->name);
+        puts(c->name);
+        for (int i = len; i < 16; i++) putchar(' ');
+        uint32_t cols[4] = { c->size, c->in_use, c->slabs, c->allocs };
+        for (int k = 0; k < 4; k++) print_padded(cols[k], k ? 8 : 7);
+        puts("\n");
+    }
+}
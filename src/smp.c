@@ -0,0 +1,236 @@
+#include "../include/common.h"
+#include "../include/smp.h"
+#include "../include/apic.h"
+#include "../include/clock.h"
+#include "../include/console.h"
+#include "../include/interrupts.h"
+#include "../include/jobs.h"
+#include "../include/workq.h"
+#include "../include/string.h"
+#include "../include/timer.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+
+//the boot cpu keeps the stack entry.S gave it, every other cpu gets one of these
+#define AP_STACK_SIZE 0x4000
+#define TRAMP_BASE    0x8000 //must match trampoline.S, and be below 1MB on a 4k boundary
+
+#define GDT_CODE   1
+#define GDT_DATA   2
+#define GDT_TSS    3                    //cpu n's tss is GDT_TSS + n
+#define GDT_DF_TSS (GDT_TSS + MAX_CPUS) //the double fault task, one for everybody
+#define GDT_PERCPU (GDT_DF_TSS + 1)     //first per cpu segment, cpu n uses GDT_PERCPU + n
+#define GDT_SIZE   (GDT_PERCPU + MAX_CPUS)
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+//no rings and no hardware task switching, except for one: a double fault switches to its
+//own task, so it still has a stack when it was the kernel stack that ran into a guard page.
+//the task switch saves the old state into the tss in tr, which is all each cpu's own tss is for
+struct tss {
+    uint32_t link, esp0, ss0, esp1, ss1, esp2, ss2, cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs, ldt;
+    uint16_t trap, iomap;
+} __attribute__((packed));
+
+struct cpu cpus[MAX_CPUS];
+uint32_t cpu_count = 1;
+volatile uint32_t cpus_online = 1;
+
+static uint64_t gdt[GDT_SIZE];
+//the first page of each is a guard page
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE + PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static struct tss cpu_tss[MAX_CPUS];
+static struct tss df_tss;
+static uint8_t df_stack[PAGE_SIZE] __attribute__((aligned(16)));
+static struct cpu* volatile ap_booting; //the one ap currently going through the trampoline
+
+extern char trampoline_start[], trampoline_end[], tramp_stack[], tramp_entry[];
+
+//access 0x9A/0x92 is present ring 0 code/data, flags 0xC is 4k granularity 32 bit, 0x4 is byte granularity
+static uint64_t gdt_entry(uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    uint64_t e = limit & 0xFFFF;
+    e |= (uint64_t)(base & 0xFFFFFF) << 16;
+    e |= (uint64_t)access << 40;
+    e |= (uint64_t)((limit >> 16) & 0xF) << 48;
+    e |= (uint64_t)(flags & 0xF) << 52;
+    e |= (uint64_t)(base >> 24) << 56;
+    return e;
+}
+
+//loads the shared gdt, points %gs at this cpu's struct and tr at its tss
+static void gdt_load(uint32_t cpu) {
+    struct gdt_ptr p = { sizeof(gdt) - 1, (uint32_t)gdt };
+    uint16_t sel = (GDT_PERCPU + cpu) * 8;
+    uint16_t tss = (GDT_TSS + cpu) * 8;
+    __asm__ volatile (
+        "lgdt %0\n"
+        "ljmp $0x08, $1f\n"
+        "1: movw $0x10, %%ax\n"
+        "movw %%ax, %%ds\n"
+        "movw %%ax, %%es\n"
+        "movw %%ax, %%fs\n"
+        "movw %%ax, %%ss\n"
+        "movw %1, %%gs\n"
+        "ltr %2\n"
+        : : "m"(p), "r"(sel), "r"(tss) : "eax", "memory");
+}
+
+void smp_early_init(void) {
+    gdt[0] = 0;
+    gdt[GDT_CODE] = gdt_entry(0, 0xFFFFF, 0x9A, 0xC);
+    gdt[GDT_DATA] = gdt_entry(0, 0xFFFFF, 0x92, 0xC);
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].index = i;
+        gdt[GDT_PERCPU + i] = gdt_entry((uint32_t)&cpus[i], sizeof(struct cpu) - 1, 0x92, 0x4);
+        cpu_tss[i].iomap = sizeof(struct tss);
+        gdt[GDT_TSS + i] = gdt_entry((uint32_t)&cpu_tss[i], sizeof(struct tss) - 1, 0x89, 0x0);
+    }
+
+    //gs is the boot cpu's, double_fault_task mustn't lean on this_cpu()
+    df_tss.cr3 = paging_directory();
+    df_tss.eip = (uint32_t)double_fault_task;
+    df_tss.eflags = 0x002;
+    df_tss.esp = (uint32_t)&df_stack[sizeof(df_stack)];
+    df_tss.cs = 0x08;
+    df_tss.ss = df_tss.ds = df_tss.es = df_tss.fs = 0x10;
+    df_tss.gs = GDT_PERCPU * 8;
+    df_tss.iomap = sizeof(struct tss);
+    gdt[GDT_DF_TSS] = gdt_entry((uint32_t)&df_tss, sizeof(struct tss) - 1, 0x89, 0x0);
+
+    cpus[0].online = 1;
+    cpus[0].stack_top = 0x90000;
+    cpus[0].online_tsc = rdtsc();
+    gdt_load(0);
+}
+
+void cpu_idle(void) {
+    struct cpu* c = this_cpu();
+    //deferred work left over from an irq counts as something to do
+    if (c->work_head) {
+        work_drain();
+        __asm__ volatile ("sti");
+        return;
+    }
+    uint64_t start = rdtsc();
+    //sti only takes effect after the next instruction, so nothing can land between it and the hlt
+    __asm__ volatile ("sti; hlt" : : : "memory");
+    c->idle_cycles += rdtsc() - start; //includes the irq that woke us, close enough
+}
+
+//first c code on an ap, still on the trampoline's gdt
+static void smp_ap_main(void) {
+    //taking the slot tells the boot cpu we made it. 0 means it gave up on us already
+    struct cpu* c = __atomic_exchange_n(&ap_booting, 0, __ATOMIC_SEQ_CST);
+    if (!c) for (;;) __asm__ volatile ("cli; hlt");
+    gdt_load(c->index);
+    paging_ap_init();
+    idt_reload();
+    apic_local_init();
+
+    c->online_tsc = rdtsc();
+    c->online = 1;
+    __atomic_fetch_add(&cpus_online, 1, __ATOMIC_SEQ_CST);
+
+    //from here on the ap just runs (and steals) jobs, sleeping when there are none
+    jobs_worker_loop();
+}
+
+static int ap_start(struct cpu* c) {
+    uint8_t* tramp = (uint8_t*)TRAMP_BASE;
+    *(uint32_t*)(tramp + (tramp_stack - trampoline_start)) = c->stack_top;
+    *(uint32_t*)(tramp + (tramp_entry - trampoline_start)) = (uint32_t)smp_ap_main;
+    ap_booting = c;
+
+    //the intel sequence: INIT, 10ms, SIPI, and a second SIPI if the first one didn't take
+    apic_send_ipi(c->apic_id, ICR_INIT | ICR_ASSERT);
+    sleep_us(10000);
+    apic_send_ipi(c->apic_id, ICR_STARTUP | ICR_ASSERT | (TRAMP_BASE >> 12));
+    sleep_us(200);
+    if (!c->online) {
+        apic_send_ipi(c->apic_id, ICR_STARTUP | ICR_ASSERT | (TRAMP_BASE >> 12));
+        for (int waited = 0; waited < 1000 && !c->online; waited++) sleep_us(100); //up to 100ms
+    }
+    if (c->online) return 1;
+    if (__atomic_exchange_n(&ap_booting, 0, __ATOMIC_SEQ_CST)) {
+        //a late ap would come up on the next one's stack and struct cpu. INIT puts it back
+        //to waiting for a SIPI wherever it got to, give it the same 10ms to get there
+        apic_send_ipi(c->apic_id, ICR_INIT | ICR_ASSERT);
+        sleep_us(10000);
+        return 0;
+    }
+    //it took the slot just in time and is a few instructions from online
+    for (int waited = 0; waited < 1000 && !c->online; waited++) sleep_us(100);
+    return c->online;
+}
+
+void smp_init(void) {
+    if (!apic_active()) return;
+    cpus[0].apic_id = apic_id();
+
+    memcpy((void*)TRAMP_BASE, trampoline_start, trampoline_end - trampoline_start);
+
+    uint32_t next = 1;
+    for (uint32_t i = 0; i < madt.cpu_count && next < MAX_CPUS; i++) {
+        uint32_t id = madt.cpu_apic_id[i];
+        if (id == cpus[0].apic_id) continue;
+
+        struct cpu* c = &cpus[next];
+        c->apic_id = id;
+        c->stack_top = (uint32_t)&ap_stacks[next][AP_STACK_SIZE + PAGE_SIZE];
+        paging_guard((uint32_t)ap_stacks[next], "ap stack");
+        //a cpu that never answers keeps its slot so the next one doesn't inherit a half started stack
+        ap_start(c);
+        next++;
+    }
+    cpu_count = next;
+}
+
+//idle time as a percentage of the time the cpu has been up
+static uint32_t idle_percent(struct cpu* c) {
+    uint64_t up = rdtsc() - c->online_tsc;
+    uint64_t idle = c->idle_cycles;
+    while (up >> 25) { up >>= 1; idle >>= 1; } //keeps idle * 100 inside 32 bits
+    if (!up) return 0;
+    return (uint32_t)idle * 100 / (uint32_t)up;
+}
+
+uint16_t smp_double_fault_tss(void) {
+    return GDT_DF_TSS * 8;
+}
+
+void smp_print_summary(void) {
+    print_uint(cpus_online);
+    puts(" of ");
+    print_uint(cpu_count);
+    puts(apic_active() ? " cpus online, boot cpu apic id " : " cpu online (no apic, smp off)");
+    if (apic_active()) print_uint(cpus[0].apic_id);
+    puts("\n");
+}
+
+void smp_print_cpus(void) {
+    puts("cpu  apic  state     irqs   jobs steals  idle  up\n");
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        struct cpu* c = &cpus[i];
+        print_uint(i);
+        puts(i < 10 ? "    " : "   ");
+        print_uint(c->apic_id);
+        puts(c->apic_id < 10 ? "     " : "    ");
+        if (!c->online) { puts("offline\n"); continue; }
+        puts("online ");
+        print_padded(c->irqs, 8);
+        print_padded(c->jobs_run, 7);
+        print_padded(c->steals, 7);
+        puts("  ");
+        print_uint(idle_percent(c));
+        puts("%  ");
+        uint64_t up_ms = tsc_khz() ? div64_u32(rdtsc() - c->online_tsc, tsc_khz(), 0) : 0;
+        print_uint((uint32_t)div64_u32(up_ms, 1000, 0));
+        puts("s\n");
+    }
+}
@@ -33,6 +33,18 @@ void strcat(char* dest, const char* src) {
     while ((*dest++ = *src++));
 }
 
+void* memcpy(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    while (n--) *d++ = *s++;
+    return dest;
+}
+
+void* memset(void* dest, int c, uint32_t n) {
+    uint8_t* d = dest;
+    while (n--) *d++ = (uint8_t)c;
+    return dest;
+}
 
 const char* cmd_args(const char* input, const char* command) {
     int i = 0;
@@ -0,0 +1,227 @@
+#include "../include/common.h"
+#include "../include/thread.h"
+#include "../include/smp.h"
+#include "../include/timer.h"
+#include "../include/clock.h"
+#include "../include/console.h"
+#include "../include/interrupts.h"
+#include "../include/string.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+
+//preemption works without any help from the interrupt stubs: an irq lands on the
+//running thread's stack, and if the slice is up interrupt_dispatch calls schedule()
+//before returning. the other thread resumes wherever it parked itself (inside its own
+//irq, or in thread_block), and we come back out through our irq frame when it is
+//our turn again. everything here runs on the boot cpu with interrupts off
+extern void switch_to(uint32_t* save_esp, uint32_t new_esp);
+
+static struct thread threads[MAX_THREADS];
+//the first page of each is a guard page
+static uint8_t thread_stacks[MAX_THREADS][THREAD_STACK_SIZE + PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static struct thread* rq_head;
+static struct thread* rq_tail;
+static struct thread* idle_thread;
+static uint32_t next_id = 0;
+static int running = 0;
+
+static struct timer slice_timer;
+
+static void rq_push(struct thread* t) {
+    t->next = 0;
+    if (rq_tail) rq_tail->next = t;
+    else rq_head = t;
+    rq_tail = t;
+}
+
+static struct thread* rq_pop(void) {
+    struct thread* t = rq_head;
+    if (!t) return 0;
+    rq_head = t->next;
+    if (!rq_head) rq_tail = 0;
+    t->next = 0;
+    return t;
+}
+
+static void copy_name(char* dst, const char* src) {
+    int i = 0;
+    while (i < THREAD_NAME_LEN - 1 && src[i]) { dst[i] = src[i]; i++; }
+    dst[i] = 0;
+}
+
+struct thread* thread_current(void) {
+    return this_cpu()->current;
+}
+
+int threads_running(void) {
+    return running;
+}
+
+static void slice_expired(void* arg) {
+    (void)arg;
+    this_cpu()->need_resched = 1;
+}
+
+void schedule(void) {
+    struct cpu* c = this_cpu();
+    struct thread* prev = c->current;
+    c->need_resched = 0;
+
+    if (prev->state == THREAD_RUNNING && prev != idle_thread) {
+        prev->state = THREAD_RUNNABLE;
+        rq_push(prev);
+    }
+    struct thread* next = rq_pop();
+    if (!next) next = idle_thread;
+
+    //only bother with a slice if somebody is queued behind whoever runs next
+    if (rq_head) {
+        if (!timer_pending(&slice_timer)) timer_add_us(&slice_timer, THREAD_SLICE_US);
+    } else {
+        timer_del(&slice_timer);
+    }
+
+    next->state = THREAD_RUNNING;
+    if (next == prev) return;
+    if (prev == idle_thread) prev->state = THREAD_RUNNABLE;
+
+    uint64_t now = rdtsc();
+    prev->cycles += now - prev->last_in;
+    next->last_in = now;
+    c->current = next;
+    switch_to(&prev->esp, next->esp);
+}
+
+void thread_block(void) {
+    struct thread* t = thread_current();
+    t->state = THREAD_BLOCKED;
+    schedule();
+}
+
+//safe from bottom halves, which run with interrupts on
+void thread_wake(struct thread* t) {
+    uint32_t flags = irq_save();
+    if (t && t->state == THREAD_BLOCKED) {
+        t->state = THREAD_RUNNABLE;
+        rq_push(t);
+        //the idle thread gives the cpu up straight away, anyone else at the end of their slice
+        if (thread_current() == idle_thread) this_cpu()->need_resched = 1;
+        else if (!timer_pending(&slice_timer)) timer_add_us(&slice_timer, THREAD_SLICE_US);
+    }
+    irq_restore(flags);
+}
+
+void thread_exit(void) {
+    arena_destroy(&thread_current()->scratch);
+    __asm__ volatile ("cli");
+    thread_current()->state = THREAD_DEAD;
+    schedule();
+    while (1); //not reached, nothing ever switches back to a dead thread
+}
+
+//where a new thread's first switch_to returns to. it arrives with interrupts off
+static void thread_entry(void) {
+    struct thread* t = thread_current();
+    __asm__ volatile ("sti");
+    t->fn(t->arg);
+    thread_exit();
+}
+
+static struct thread* thread_alloc(void) {
+    for (int i = 0; i < MAX_THREADS; i++) {
+        struct thread* t = &threads[i];
+        if (t->state == THREAD_UNUSED || (t->state == THREAD_DEAD && t != thread_current())) return t;
+    }
+    return 0;
+}
+
+static void thread_setup(struct thread* t, const char* name, void (*fn)(void*), void* arg) {
+    t->id = next_id++;
+    copy_name(t->name, name);
+    t->fn = fn;
+    t->arg = arg;
+    t->cycles = 0;
+    t->quiet = 0;
+    t->cmd_depth = 0;
+
+    //what switch_to pops: eflags, edi, esi, ebx, ebp, then it returns into thread_entry
+    uint32_t* sp = (uint32_t*)&thread_stacks[t - threads][THREAD_STACK_SIZE + PAGE_SIZE];
+    *--sp = 0;                        //thread_entry's return address, never used
+    *--sp = (uint32_t)thread_entry;
+    *--sp = 0;                        //ebp, ends the profiler's frame walk
+    *--sp = 0;                        //ebx
+    *--sp = 0;                        //esi
+    *--sp = 0;                        //edi
+    *--sp = 0x002;                    //eflags, interrupts off until thread_entry
+    t->esp = (uint32_t)sp;
+}
+
+struct thread* thread_create(const char* name, void (*fn)(void*), void* arg) {
+    uint32_t flags = irq_save();
+    struct thread* t = thread_alloc();
+    if (!t) { irq_restore(flags); return 0; }
+
+    thread_setup(t, name, fn, arg);
+    t->state = THREAD_BLOCKED;
+    thread_wake(t);
+    irq_restore(flags);
+    return t;
+}
+
+static void idle_loop(void* arg) {
+    (void)arg;
+    while (1) {
+        __asm__ volatile ("cli");
+        if (rq_head) schedule();
+        else cpu_idle();
+    }
+}
+
+void threads_init(void) {
+    timer_setup(&slice_timer, slice_expired, 0);
+    //no thread has run on these stacks yet, so no cpu has their guard pages in its tlb
+    for (int i = 0; i < MAX_THREADS; i++) paging_guard((uint32_t)thread_stacks[i], "thread stack");
+
+    //whatever is running right now (kernel_main) becomes thread 0
+    struct thread* shell = &threads[0];
+    shell->id = next_id++;
+    copy_name(shell->name, "shell");
+    shell->state = THREAD_RUNNING;
+    shell->last_in = rdtsc();
+    this_cpu()->current = shell;
+
+    //the idle thread never goes on the run queue, schedule() falls back to it
+    idle_thread = &threads[1];
+    thread_setup(idle_thread, "idle", idle_loop, 0);
+    idle_thread->state = THREAD_RUNNABLE;
+    running = 1;
+}
+
+static const char* state_names[] = { "unused", "ready", "running", "blocked", "dead" };
+
+void threads_print(void) {
+    uint32_t flags = irq_save();
+    //the running thread's time so far hasn't been added yet
+    struct thread* cur = thread_current();
+    uint64_t now = rdtsc();
+    cur->cycles += now - cur->last_in;
+    cur->last_in = now;
+    irq_restore(flags);
+
+    puts("  id  state         cpu ms  name\n");
+    for (int i = 0; i < MAX_THREADS; i++) {
+        struct thread* t = &threads[i];
+        if (t->state == THREAD_UNUSED || t->state == THREAD_DEAD) continue;
+        uint32_t ms = (uint32_t)div64_u32(tsc_to_ns(t->cycles), 1000000, 0);
+
+        puts("  ");
+        print_uint(t->id);
+        puts(t->id < 10 ? "   " : "  ");
+        puts(state_names[t->state]);
+        for (int k = strlen(state_names[t->state]); k < 8; k++) putchar(' ');
+        print_padded(ms, 10);
+        puts("  ");
+        puts(t->name);
+        puts("\n");
+    }
+}
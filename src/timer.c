@@ -0,0 +1,341 @@
+#include "../include/common.h"
+#include "../include/timer.h"
+#include "../include/clock.h"
+#include "../include/interrupts.h"
+#include "../include/smp.h"
+#include "../include/thread.h"
+#include "../include/workq.h"
+#include "../include/apic.h"
+#include "../include/profile.h"
+
+//hierarchical timing wheel, same idea as the classic linux one:
+//level 0 has a slot per tick for the next 256 ticks, every level above it
+//covers 64 times the range of the one below. adding and removing is O(1),
+//timers only move down a level when their slot in the upper level comes up.
+//
+//with a one-shot event source (the local apic timer, or else an hpet comparator)
+//we run tickless: after every interrupt the wheel works out its next deadline and
+//arms a one-shot for exactly that, so an idle kernel with nothing pending takes no
+//timer interrupts at all. without one the pit ticks at TIMER_HZ and each tick just
+//catches the wheel up to clock_ns()
+#define WHEEL0_BITS 8
+#define WHEELN_BITS 6
+#define WHEEL0_SIZE (1 << WHEEL0_BITS)
+#define WHEELN_SIZE (1 << WHEELN_BITS)
+#define WHEEL0_MASK (WHEEL0_SIZE - 1)
+#define WHEELN_MASK (WHEELN_SIZE - 1)
+#define WHEEL_UPPER 3
+
+#define LEVEL_SHIFT(n) (WHEEL0_BITS + (n) * WHEELN_BITS)
+#define WHEEL_MAX_TICKS ((1ULL << LEVEL_SHIFT(WHEEL_UPPER)) - 1)
+
+static struct timer* wheel0[WHEEL0_SIZE];
+static struct timer* wheeln[WHEEL_UPPER][WHEELN_SIZE];
+static uint32_t wheel0_bits[WHEEL0_SIZE / 32]; //which level 0 slots have anything in them
+static uint64_t wheel_jiffies = 0; //next tick to be processed
+static int timers_running = 0;
+static int tickless = 0;
+static int in_timer_run = 0;
+static uint64_t armed_tick = ~0ULL; //tick the comparator is set for, ~0 when nothing is armed
+static int (*event_arm)(uint64_t deadline_ns); //apic_timer_arm or hpet_arm
+
+//the wheel is walked from a bottom half with interrupts on. that's safe because hard
+//irq handlers never touch it, and thread code only does with interrupts off
+static struct work timer_work;
+
+static uint64_t ns_to_ticks(uint64_t ns) {
+    return div64_u32(ns, TIMER_TICK_NS, 0);
+}
+
+uint64_t timer_now(void) {
+    return ns_to_ticks(clock_ns());
+}
+
+static int in_wheel0(struct timer** head) {
+    return head >= &wheel0[0] && head < &wheel0[WHEEL0_SIZE];
+}
+
+static void list_add(struct timer** head, struct timer* t) {
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    if (in_wheel0(head)) {
+        int idx = head - wheel0;
+        wheel0_bits[idx >> 5] |= 1u << (idx & 31);
+    }
+}
+
+static void list_del(struct timer* t) {
+    struct timer** head = t->pprev;
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = 0;
+    t->pprev = 0;
+    if (in_wheel0(head) && !*head) {
+        int idx = head - wheel0;
+        wheel0_bits[idx >> 5] &= ~(1u << (idx & 31));
+    }
+}
+
+//distance from idx to the next occupied level 0 slot at or after it, without wrapping.
+//returns WHEEL0_SIZE - idx if there is none before the end of the wheel
+static uint32_t wheel0_scan(uint32_t idx) {
+    uint32_t word = idx >> 5;
+    uint32_t bits = wheel0_bits[word] & (~0u << (idx & 31));
+    while (1) {
+        if (bits) {
+            uint32_t bit;
+            __asm__ ("bsf %1, %0" : "=r"(bit) : "rm"(bits));
+            return (word << 5) + bit - idx;
+        }
+        if (++word >= WHEEL0_SIZE / 32) return WHEEL0_SIZE - idx;
+        bits = wheel0_bits[word];
+    }
+}
+
+//picks the slot from how far away the timer is, must be called with interrupts off (or from timer_bh)
+static void wheel_insert(struct timer* t) {
+    uint64_t expires = t->expires;
+    int64_t delta = (int64_t)(expires - wheel_jiffies);
+
+    if (delta < 0) {
+        //already due, run it on the next tick we process
+        list_add(&wheel0[wheel_jiffies & WHEEL0_MASK], t);
+        return;
+    }
+    if (delta < WHEEL0_SIZE) {
+        list_add(&wheel0[expires & WHEEL0_MASK], t);
+        return;
+    }
+    if ((uint64_t)delta > WHEEL_MAX_TICKS) {
+        //further out than the wheel reaches, park it in the furthest slot and it gets re-sorted later
+        expires = wheel_jiffies + WHEEL_MAX_TICKS;
+        delta = WHEEL_MAX_TICKS;
+    }
+    for (int n = 0; n < WHEEL_UPPER; n++) {
+        if ((uint64_t)delta < (1ULL << LEVEL_SHIFT(n + 1)) || n == WHEEL_UPPER - 1) {
+            list_add(&wheeln[n][(expires >> LEVEL_SHIFT(n)) & WHEELN_MASK], t);
+            return;
+        }
+    }
+}
+
+//moves every timer in one upper slot back down to where it belongs now, returns the slot index
+static int cascade(int n) {
+    int idx = (wheel_jiffies >> LEVEL_SHIFT(n)) & WHEELN_MASK;
+    struct timer* t = wheeln[n][idx];
+    wheeln[n][idx] = 0;
+    while (t) {
+        struct timer* next = t->next;
+        t->next = 0;
+        t->pprev = 0;
+        wheel_insert(t);
+        t = next;
+    }
+    return idx;
+}
+
+//runs every tick up to and including now, called with interrupts off or from timer_bh.
+//empty stretches are skipped a slot word at a time so catching up after a long idle is cheap
+static void timer_run(uint64_t now) {
+    in_timer_run = 1;
+    while (wheel_jiffies <= now) {
+        int idx = wheel_jiffies & WHEEL0_MASK;
+        if (idx == 0) {
+            for (int n = 0; n < WHEEL_UPPER; n++)
+                if (cascade(n) != 0) break;
+        }
+
+        if (!wheel0[idx]) {
+            //nothing here, jump to the next occupied slot or the next cascade, whichever is first
+            uint64_t skip = wheel0_scan(idx);
+            if (skip > now - wheel_jiffies + 1) skip = now - wheel_jiffies + 1;
+            if (skip == 0) skip = 1;
+            wheel_jiffies += skip;
+            continue;
+        }
+
+        //take the whole slot first so callbacks that re-arm land in a later slot
+        struct timer* t = wheel0[idx];
+        wheel0[idx] = 0;
+        wheel0_bits[idx >> 5] &= ~(1u << (idx & 31));
+        t->pprev = &t;
+        wheel_jiffies++;
+
+        while (t) {
+            struct timer* cur = t;
+            list_del(cur);
+            cur->fn(cur->arg);
+        }
+    }
+    in_timer_run = 0;
+}
+
+//earliest tick the wheel needs to run at, ~0 if no timers are pending.
+//for the upper levels that is when the first occupied slot gets cascaded down,
+//which is never later than the timers inside it
+static uint64_t timer_next_event(void) {
+    uint32_t idx = wheel_jiffies & WHEEL0_MASK;
+    uint32_t d = wheel0_scan(idx);
+    if (d < WHEEL0_SIZE - idx) return wheel_jiffies + d;
+
+    //past the wrap a cascade can drop something in ahead of what level 0 already has
+    uint64_t best = ~0ULL;
+    d = wheel0_scan(0);
+    if (d < idx) best = wheel_jiffies + (WHEEL0_SIZE - idx) + d;
+    for (int n = 0; n < WHEEL_UPPER; n++) {
+        uint64_t span = 1ULL << LEVEL_SHIFT(n);
+        //first tick of the next block at this level that hasn't been cascaded yet
+        uint64_t base = (wheel_jiffies + span - 1) & ~(span - 1);
+        uint32_t cur = (base >> LEVEL_SHIFT(n)) & WHEELN_MASK;
+        for (uint32_t k = 0; k < WHEELN_SIZE; k++) {
+            if (wheeln[n][(cur + k) & WHEELN_MASK]) {
+                uint64_t at = base + k * span;
+                if (at < best) best = at;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+//tickless only, points the comparator at the next deadline. if that deadline has
+//already gone by it runs the wheel right here and tries again
+static void timer_reprogram(void) {
+    while (1) {
+        uint64_t next = timer_next_event();
+        if (next == ~0ULL) { armed_tick = ~0ULL; return; }
+        if (next == armed_tick) return;
+        if (event_arm(next * TIMER_TICK_NS) == 0) { armed_tick = next; return; }
+        armed_tick = ~0ULL;
+        timer_run(timer_now());
+    }
+}
+
+volatile uint32_t timer_ticks = 0;
+
+//the local apic timer, or irq0 from the hpet comparator or the pit
+static void timer_irq(struct regs* r, void* ctx) {
+    (void)ctx;
+    //with a one-shot we know exactly when this was meant to arrive
+    if (tickless && armed_tick != ~0ULL) {
+        int64_t late = (int64_t)(clock_ns() - armed_tick * TIMER_TICK_NS);
+        interrupt_record_latency(r->int_no, late > 0 ? (uint64_t)late : 0);
+    }
+    timer_ticks++;
+    profile_sample(r); //needs the interrupted registers, so it can't be deferred
+    work_queue(&timer_work);
+}
+
+static void timer_bh(void* arg) {
+    (void)arg;
+    timer_tick();
+}
+
+//picks the event source: the local apic timer (no trip over the io bus to arm it or
+//to eoi it), then the hpet comparator if it can do one-shots, otherwise the pit
+void timer_subsystem_init(void) {
+    wheel_jiffies = timer_now();
+    work_setup(&timer_work, timer_bh, 0);
+    timers_running = 1;
+
+    if (apic_timer_init()) {
+        interrupt_register(APIC_TIMER_VECTOR, timer_irq, 0);
+        event_arm = apic_timer_arm;
+        tickless = 1;
+        return;
+    }
+
+    irq_register(0, timer_irq, 0);
+    if (hpet_oneshot_init()) {
+        event_arm = hpet_arm;
+        tickless = 1;
+    } else {
+        init_pit(TIMER_HZ);
+    }
+}
+
+int timer_tickless(void) {
+    return tickless;
+}
+
+void timer_setup(struct timer* t, void (*fn)(void*), void* arg) {
+    t->next = 0;
+    t->pprev = 0;
+    t->expires = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+//arms (or re-arms) a timer for an absolute tick
+void timer_add(struct timer* t, uint64_t expires) {
+    uint32_t flags = irq_save();
+    if (t->pprev) list_del(t);
+    t->expires = expires;
+    wheel_insert(t);
+    //callbacks re-arming from inside timer_run get picked up when the tick finishes
+    if (tickless && !in_timer_run && expires < armed_tick) timer_reprogram();
+    irq_restore(flags);
+}
+
+//arms a timer at least us microseconds from now
+void timer_add_us(struct timer* t, uint64_t us) {
+    uint64_t deadline = clock_ns() + us * 1000;
+    uint32_t rem;
+    uint64_t ticks = div64_u32(deadline, TIMER_TICK_NS, &rem);
+    if (rem) ticks++;
+    timer_add(t, ticks);
+}
+
+void timer_del(struct timer* t) {
+    uint32_t flags = irq_save();
+    if (t->pprev) list_del(t);
+    irq_restore(flags);
+}
+
+int timer_pending(struct timer* t) {
+    return t->pprev != 0;
+}
+
+//runs whatever is due, called from the timer's bottom half
+void timer_tick(void) {
+    if (!timers_running) return;
+    if (tickless) armed_tick = ~0ULL; //the one-shot is spent
+    timer_run(timer_now());
+    if (tickless) timer_reprogram();
+}
+
+struct sleeper {
+    volatile int done;
+    struct thread* t; //0 before threads_init and on the aps, those just hlt
+};
+
+static void sleep_wakeup(void* arg) {
+    struct sleeper* s = arg;
+    s->done = 1;
+    if (s->t) thread_wake(s->t);
+}
+
+void sleep_us(uint64_t us) {
+    if (!timers_running) {
+        uint64_t start = clock_us();
+        while (clock_us() - start < us);
+        return;
+    }
+
+    struct sleeper s = { 0, this_cpu()->current };
+    struct timer t;
+    timer_setup(&t, sleep_wakeup, &s);
+    timer_add_us(&t, us);
+
+    //a thread blocks so everything else gets the cpu while it sleeps
+    while (1) {
+        //interrupts stay off from the check until we block (or cpu_idle's sti; hlt), so an irq can't sneak in between
+        __asm__ volatile ("cli");
+        if (s.done) break;
+        if (s.t) thread_block();
+        else cpu_idle();
+    }
+    __asm__ volatile ("sti");
+}
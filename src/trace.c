@@ -0,0 +1,147 @@
+#include "../include/common.h"
+#include "../include/console.h"
+#include "../include/trace.h"
+#include "../include/clock.h"
+#include "../include/serial.h"
+
+
+//fixed size ring of compact records. writers grab a slot with one atomic add, so irq
+//handlers and normal code can trace at the same time without a lock. the ring overwrites
+//the oldest records when it wraps, and each record carries the sequence number it was
+//written for so the dump can tell a finished record from a stale or half written one
+#define TRACE_SIZE 4096 //power of two
+#define TRACE_MASK (TRACE_SIZE - 1)
+
+struct trace_rec {
+    uint64_t tsc;
+    uint32_t seq;
+    uint16_t id;
+    uint16_t pad;
+    uint32_t a0, a1;
+};
+
+struct trace_event {
+    const char* name;
+    char a0_fmt; //u = decimal, x = hex, s = 4 char tag
+    char a1_fmt;
+};
+
+static const struct trace_event trace_events[TRACE_EVENT_COUNT] = {
+    [TRACE_IRQ]       = { "irq",       'u', 'x' },
+    [TRACE_CMD_ENTER] = { "cmd_enter", 's', 'u' },
+    [TRACE_CMD_EXIT]  = { "cmd_exit",  's', 'u' },
+    [TRACE_FS_CREATE] = { "fs_create", 's', 'u' },
+    [TRACE_FIND_FILE] = { "find_file", 's', 'u' },
+    [TRACE_GETKEY]    = { "getkey",    'x', 'u' },
+};
+
+volatile int trace_enabled = 0;
+static struct trace_rec trace_ring[TRACE_SIZE];
+static volatile uint32_t trace_head = 0; //next sequence number to hand out
+
+void trace_emit(uint32_t id, uint32_t a0, uint32_t a1) {
+    uint32_t seq = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    struct trace_rec* r = &trace_ring[seq & TRACE_MASK];
+    __atomic_store_n(&r->seq, ~0u, __ATOMIC_RELAXED); //mark it as being written
+    r->tsc = rdtsc();
+    r->id = (uint16_t)id;
+    r->a0 = a0;
+    r->a1 = a1;
+    __atomic_store_n(&r->seq, seq, __ATOMIC_RELEASE);
+}
+
+//first 4 characters packed into a word, enough to tell commands and files apart on a timeline
+uint32_t trace_tag(const char* s) {
+    uint32_t tag = 0;
+    for (int i = 0; i < 4 && s[i]; i++) tag |= (uint32_t)(uint8_t)s[i] << (i * 8);
+    return tag;
+}
+
+void trace_start(void) {
+    trace_enabled = 1;
+}
+
+void trace_stop(void) {
+    trace_enabled = 0;
+}
+
+void trace_clear(void) {
+    trace_head = 0;
+    for (int i = 0; i < TRACE_SIZE; i++) trace_ring[i].seq = ~0u;
+}
+
+static void serial_write_hex(uint32_t v) {
+    serial_write("0x");
+    for (int i = 28; i >= 0; i -= 4) serial_putc("0123456789abcdef"[(v >> i) & 0xF]);
+}
+
+static void serial_write_u64(uint64_t v) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        uint32_t digit;
+        v = div64_u32(v, 10, &digit);
+        buf[--i] = '0' + digit;
+    } while (v);
+    serial_write(&buf[i]);
+}
+
+static void write_arg(char fmt, uint32_t v) {
+    serial_putc(' ');
+    if (fmt == 'x') { serial_write_hex(v); return; }
+    if (fmt == 's') {
+        for (int i = 0; i < 4; i++) {
+            char c = (char)(v >> (i * 8));
+            serial_putc(c > ' ' && c < 127 ? c : '_');
+        }
+        return;
+    }
+    serial_write_uint(v);
+}
+
+//one text line per record on COM1: "<tsc> <event> <a0> <a1>", oldest first.
+//tools/trace2json.py turns that into a chrome://tracing / perfetto timeline
+void trace_dump(void) {
+    int was_enabled = trace_enabled;
+    trace_enabled = 0;
+
+    uint32_t head = trace_head;
+    uint32_t first = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+    uint32_t written = 0, skipped = 0;
+
+    serial_write("# luxos trace v1 tsc_khz=");
+    serial_write_uint(tsc_khz());
+    serial_putc('\n');
+
+    for (uint32_t seq = first; seq != head; seq++) {
+        struct trace_rec* r = &trace_ring[seq & TRACE_MASK];
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != seq || r->id >= TRACE_EVENT_COUNT) { skipped++; continue; }
+        const struct trace_event* ev = &trace_events[r->id];
+        serial_write_u64(r->tsc);
+        serial_putc(' ');
+        serial_write(ev->name);
+        write_arg(ev->a0_fmt, r->a0);
+        write_arg(ev->a1_fmt, r->a1);
+        serial_putc('\n');
+        written++;
+    }
+    serial_write("# end\n");
+
+    puts("wrote ");
+    print_uint(written);
+    puts(" trace records to COM1");
+    if (head > TRACE_SIZE) {
+        puts(", ");
+        print_uint(head - TRACE_SIZE);
+        puts(" older ones were overwritten");
+    }
+    if (skipped) {
+        puts(", ");
+        print_uint(skipped);
+        puts(" incomplete");
+    }
+    puts("\n");
+
+    trace_enabled = was_enabled;
+}
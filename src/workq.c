@@ -0,0 +1,100 @@
+#include "../include/common.h"
+#include "../include/workq.h"
+#include "../include/smp.h"
+#include "../include/apic.h"
+#include "../include/clock.h"
+#include "../include/console.h"
+#include "../include/interrupts.h"
+
+//each cpu has its own fifo in struct cpu. only that cpu ever touches it, with
+//interrupts off, so there is no locking. a drain that is already running on this
+//cpu (an irq landed while it had interrupts on) is left alone, the outer one picks
+//the new work up before it returns
+static uint32_t work_runs = 0;
+static uint32_t work_queued = 0;     //queue calls that actually queued something
+static uint32_t work_collapsed = 0;  //queue calls that found the item already pending
+static uint32_t drain_cut = 0;       //drains that stopped on the budget
+static uint32_t drain_max_cycles = 0;
+
+static void defer_ipi(struct regs* r, void* ctx) {
+    (void)r; (void)ctx; //the drain happens on the way out of this irq
+}
+
+void workq_init(void) {
+    interrupt_register(DEFER_VECTOR, defer_ipi, 0);
+}
+
+void work_setup(struct work* w, void (*fn)(void*), void* arg) {
+    w->next = 0;
+    w->fn = fn;
+    w->arg = arg;
+    w->pending = 0;
+}
+
+void work_queue(struct work* w) {
+    uint32_t flags = irq_save();
+    if (w->pending) {
+        work_collapsed++;
+        irq_restore(flags);
+        return;
+    }
+    struct cpu* c = this_cpu();
+    w->pending = 1;
+    w->next = 0;
+    if (c->work_tail) c->work_tail->next = w;
+    else c->work_head = w;
+    c->work_tail = w;
+    work_queued++;
+    irq_restore(flags);
+}
+
+int work_pending(void) {
+    return this_cpu()->work_head != 0;
+}
+
+void work_drain(void) {
+    struct cpu* c = this_cpu();
+    if (c->in_drain || !c->work_head) return;
+    c->in_drain = 1;
+
+    uint64_t start = rdtsc();
+    uint64_t budget = (uint64_t)(tsc_khz() / 1000) * WORK_BUDGET_US; //0 without a calibrated tsc, then only the item count applies
+    int n = 0;
+    while (c->work_head) {
+        if (n >= WORK_BUDGET_ITEMS || (budget && rdtsc() - start >= budget)) {
+            drain_cut++;
+            //come straight back for the rest once whatever else is pending has had its turn
+            if (apic_active()) apic_send_ipi(0, ICR_SELF | ICR_FIXED | DEFER_VECTOR);
+            break;
+        }
+        struct work* w = c->work_head;
+        c->work_head = w->next;
+        if (!c->work_head) c->work_tail = 0;
+        w->next = 0;
+        w->pending = 0; //cleared first, so an irq during fn can queue it again
+
+        __asm__ volatile ("sti");
+        w->fn(w->arg);
+        __asm__ volatile ("cli");
+        n++;
+        work_runs++;
+    }
+
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    if (cycles > drain_max_cycles) drain_max_cycles = cycles;
+    c->in_drain = 0;
+}
+
+void workq_print_stats(void) {
+    puts("deferred work: ");
+    print_uint(work_runs);
+    puts(" run, ");
+    print_uint(work_queued);
+    puts(" queued, ");
+    print_uint(work_collapsed);
+    puts(" merged into a pending run, ");
+    print_uint(drain_cut);
+    puts(" drains hit the budget, longest drain ");
+    print_uint(drain_max_cycles);
+    puts(" cycles\n");
+}
@@ -0,0 +1,13 @@
+#!/bin/sh
+# turns `nm -n kernel` output on stdin into a C symbol table for the profiler.
+# only text symbols are kept, already sorted by address so the kernel can binary search.
+# run with no input (< /dev/null) to get an empty table for the first link pass.
+
+echo '/* generated by tools/gensyms.sh, do not edit */'
+echo '#include "../include/ksyms.h"'
+echo ''
+echo 'const struct ksym ksyms[] = {'
+awk '$2 ~ /^[tT]$/ && $3 !~ /^\./ { printf "    { 0x%s, \"%s\" },\n", $1, $3; n++ }
+     END { if (n == 0) print "    { 0, \"\" }," }'
+echo '};'
+echo 'const uint32_t ksym_count = sizeof(ksyms) / sizeof(ksyms[0]);'
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+"""Turn a LuxOS `trace dump` (captured from COM1) into Chrome trace JSON.
+
+    qemu-system-i386 -kernel kernel.bin -serial file:trace.txt
+    tools/trace2json.py trace.txt > trace.json   # open in chrome://tracing or ui.perfetto.dev
+"""
+import json
+import sys
+
+
+def main():
+    src = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    tsc_khz = 1
+    events = []
+    for line in src:
+        line = line.strip()
+        if line.startswith("# luxos trace"):
+            for field in line.split():
+                if field.startswith("tsc_khz="):
+                    tsc_khz = max(int(field.split("=")[1]), 1)
+            continue
+        if not line or line.startswith("#"):
+            continue
+        parts = line.split()
+        if len(parts) < 4:
+            continue
+        ts_us = int(parts[0]) * 1000.0 / tsc_khz
+        name, a0, a1 = parts[1], parts[2], parts[3]
+        ev = {"ts": ts_us, "pid": 0, "tid": 0, "args": {"a0": a0, "a1": a1}}
+        if name == "cmd_enter":
+            ev.update(name=a0.strip("_"), ph="B")
+        elif name == "cmd_exit":
+            ev.update(name=a0.strip("_"), ph="E")
+        else:
+            ev.update(name=name, ph="i", s="t")
+        events.append(ev)
+    json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()